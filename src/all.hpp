@@ -3,7 +3,9 @@
 
 #pragma once
 
+#include <cassert>
 #include <memory>
+#include <utility>
 
 namespace all {
 
@@ -13,7 +15,12 @@ using rebind_alloc_t =
 
 class memory_pool {
 private:
-  static constexpr auto header_size{sizeof(char*)};
+  struct block_header {
+    char* next_;
+    std::size_t size_;
+  };
+
+  static constexpr auto header_size{sizeof(block_header)};
 
 public:
   inline memory_pool() noexcept {
@@ -30,21 +37,19 @@ public:
       , total_used_{other.total_used_}
       , current_size_{other.current_size_}
       , current_used_{other.current_used_}
-      , current_{other.current_} {
+      , current_{other.current_}
+      , allocations_{other.allocations_} {
     other.total_allocated_ = 0;
     other.total_used_ = 0;
     other.current_size_ = 0;
     other.current_used_ = 0;
     other.current_ = nullptr;
+    other.allocations_ = 0;
   }
 
   ~memory_pool() {
     for (auto current{current_}; current != nullptr;) {
-      current -= header_size;
-
-      auto next{*reinterpret_cast<char**>(current)};
-      delete[] current;
-      current = next;
+      current = release(current);
     }
   }
 
@@ -58,11 +63,13 @@ public:
   memory_pool& operator=(memory_pool const&) = delete;
 
   [[nodiscard]] char* get(std::size_t size, std::size_t align) {
-    if (size > current_size_ - current_used_) {
+    auto pad{padding(current_ + current_used_, align)};
+    if (size + pad > current_size_ - current_used_) {
       extend(std::max(size + align, total_allocated_ >> 1));
+      pad = padding(current_, align);
     }
 
-    current_used_ += reinterpret_cast<std::uintptr_t>(current_) % align;
+    current_used_ += pad;
 
     auto result{current_ + current_used_};
     current_used_ += size;
@@ -71,28 +78,99 @@ public:
     return result;
   }
 
+  void reset(std::size_t required) {
+    char* largest{nullptr};
+    for (auto current{current_}; current != nullptr;) {
+      auto next{next_of(current)};
+
+      if (largest == nullptr || size_of(current) > size_of(largest)) {
+        std::swap(current, largest);
+      }
+
+      if (current != nullptr) {
+        release(current);
+      }
+
+      current = next;
+    }
+
+    if (largest != nullptr && size_of(largest) < required) {
+      release(largest);
+      largest = nullptr;
+    }
+
+    current_ = largest;
+    current_size_ = largest != nullptr ? size_of(largest) : 0;
+    current_used_ = 0;
+
+    total_allocated_ = current_size_;
+    total_used_ = 0;
+
+    if (current_ != nullptr) {
+      header_of(current_)->next_ = nullptr;
+    }
+    else if (required != 0) {
+      extend(required);
+    }
+  }
+
   [[nodiscard]] inline std::size_t total_used() const noexcept {
     return total_used_;
   }
 
+  [[nodiscard]] inline std::size_t total_allocated() const noexcept {
+    return total_allocated_;
+  }
+
+  [[nodiscard]] inline std::size_t allocations() const noexcept {
+    return allocations_;
+  }
+
   inline void swap(memory_pool& other) noexcept {
     std::swap(total_allocated_, other.total_allocated_);
     std::swap(total_used_, other.total_used_);
     std::swap(current_size_, other.current_size_);
     std::swap(current_used_, other.current_used_);
     std::swap(current_, other.current_);
+    std::swap(allocations_, other.allocations_);
   }
 
 private:
   void extend(std::size_t size) {
     auto block{new char[size + header_size]};
 
-    new (block) char*(current_);
+    new (block) block_header{current_, size};
     current_ = block + header_size;
 
     total_allocated_ += size;
     current_size_ = size;
     current_used_ = 0;
+
+    ++allocations_;
+  }
+
+  [[nodiscard]] static inline std::size_t padding(char const* position,
+                                                 std::size_t align) noexcept {
+    auto rest{reinterpret_cast<std::uintptr_t>(position) % align};
+    return rest != 0 ? align - rest : 0;
+  }
+
+  [[nodiscard]] static inline block_header* header_of(char* block) noexcept {
+    return reinterpret_cast<block_header*>(block - header_size);
+  }
+
+  [[nodiscard]] static inline std::size_t size_of(char* block) noexcept {
+    return header_of(block)->size_;
+  }
+
+  [[nodiscard]] static inline char* next_of(char* block) noexcept {
+    return header_of(block)->next_;
+  }
+
+  static inline char* release(char* block) noexcept {
+    auto next{next_of(block)};
+    delete[] reinterpret_cast<char*>(header_of(block));
+    return next;
   }
 
 private:
@@ -103,6 +181,8 @@ private:
   std::size_t current_used_{0};
 
   char* current_{nullptr};
+
+  std::size_t allocations_{0};
 };
 
 template<typename Ty>
@@ -148,14 +228,68 @@ private:
   friend class frame_allocator;
 };
 
+class arena_scope {
+public:
+  inline explicit arena_scope(std::size_t preallocated = 0)
+      : pool_{preallocated}
+      , previous_{std::exchange(current_, &pool_)} {
+  }
+
+  inline ~arena_scope() {
+    current_ = previous_;
+  }
+
+  arena_scope(arena_scope const&) = delete;
+  arena_scope& operator=(arena_scope const&) = delete;
+
+  [[nodiscard]] inline memory_pool& pool() noexcept {
+    return pool_;
+  }
+
+  [[nodiscard]] static inline memory_pool& current() noexcept {
+    return *current_;
+  }
+
+  [[nodiscard]] static inline bool active() noexcept {
+    return current_ != nullptr;
+  }
+
+private:
+  memory_pool pool_;
+  memory_pool* previous_;
+
+  static inline thread_local memory_pool* current_{nullptr};
+};
+
+// binds to the innermost arena_scope of the constructing thread, which has to
+// be active
+template<typename Ty>
+class arena_allocator : public frame_allocator<Ty> {
+public:
+  inline arena_allocator() noexcept
+      : frame_allocator<Ty>{(assert(arena_scope::active()),
+                             arena_scope::current())} {
+  }
+
+  template<typename Tx>
+  inline arena_allocator(arena_allocator<Tx> const& other) noexcept
+      : frame_allocator<Ty>{other} {
+  }
+};
+
 template<typename Ty>
 class memory_stack {
 public:
   using allocator_type = frame_allocator<Ty>;
 
 public:
+  inline memory_stack() noexcept = default;
+
+  memory_stack(memory_stack const&) = delete;
+  memory_stack& operator=(memory_stack const&) = delete;
+
   inline void prepare() {
-    *current_ = {previous_->total_used() << 1};
+    current_->reset(previous_->total_used() << 1);
   }
 
   inline void rotate() noexcept {
@@ -170,6 +304,10 @@ public:
     return allocator_type{*previous_};
   }
 
+  [[nodiscard]] inline std::size_t allocations() const noexcept {
+    return pools_[0].allocations() + pools_[1].allocations();
+  }
+
 private:
   memory_pool pools_[2];
   memory_pool* previous_{pools_};
@@ -189,7 +327,14 @@ public:
   }
 
   inline ~memory_swing() {
-    stack_->rotate();
+    if (rotate_) {
+      stack_->rotate();
+    }
+  }
+
+  // previous allocations stay alive for the next swing
+  inline void hold() noexcept {
+    rotate_ = false;
   }
 
   [[nodiscard]] inline operator allocator_type() const noexcept {
@@ -202,6 +347,7 @@ public:
 
 private:
   stack_type* stack_;
+  bool rotate_{true};
 };
 
 } // namespace all
@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include "all.hpp"
 #include "fgm.hpp"
 
 #include <intrin.h>
@@ -137,8 +138,12 @@ namespace details {
   };
 
   template<std::uint8_t Size>
-  using pattern_counter =
-      std::unordered_map<buffer<Size>, std::uint32_t, buffer_hash<Size>>;
+  using pattern_counter = std::unordered_map<
+      buffer<Size>,
+      std::uint32_t,
+      buffer_hash<Size>,
+      std::equal_to<buffer<Size>>,
+      all::arena_allocator<std::pair<buffer<Size> const, std::uint32_t>>>;
 
   template<std::uint8_t Size>
   requires odd_size<Size>
@@ -252,7 +257,30 @@ namespace details {
     return result;
   }
 
-  [[nodiscard]] sid::nat::dimg_t blur(fgm::fragment::matrix_type const& dots,
+  // adds count * weight of the cell for each color in present
+  inline void weigh(fgm::cell_map const& map,
+                    fgm::cell c,
+                    std::uint16_t present,
+                    float weight,
+                    std::array<float, fgm::depth>& temp) noexcept {
+    if (!c.spilled()) {
+      if (auto color{c.color()}; !c.empty() && (present >> color & 1) != 0) {
+        temp[color] += static_cast<float>(std::min<std::uint32_t>(
+                           c.count(), fgm::max_count)) *
+                       weight;
+      }
+    }
+    else {
+      auto& dot{map.histogram(c)};
+      for (std::uint8_t i{0}; i < fgm::depth; ++i) {
+        if ((present >> i & 1) != 0) {
+          temp[i] += dot[i] * weight;
+        }
+      }
+    }
+  }
+
+  [[nodiscard]] sid::nat::dimg_t blur(fgm::cell_map const& map,
                                       mrl::matrix<float> const& heatmap,
                                       float dev) {
     auto kernel{details::gauss_kernel(dev)};
@@ -260,36 +288,36 @@ namespace details {
     auto size{kernel.width()};
     auto margin{size / 2};
 
-    auto width{dots.width()};
+    auto& cells{map.cells()};
+
+    auto width{cells.width()};
     auto vstride{margin * width};
 
     auto kdata{kernel.data()};
 
-    auto input{dots.data()};
+    auto input{cells.data()};
     auto cond{heatmap.data()};
 
     sid::nat::dimg_t result{heatmap.dimensions()};
     auto output{result.data()};
 
     for (auto outer{input + vstride + margin},
-         ocend{dots.end() - vstride - margin};
+         ocend{cells.end() - vstride - margin};
          outer < ocend;
          outer += size) {
-      for (auto orend{outer + dots.width() - size}; outer < orend; ++outer) {
+      for (auto orend{outer + width - size}; outer < orend; ++outer) {
         if (cond[outer - input] > 0.25f) {
+          auto present{map.colors(*outer)};
+
           auto k{kdata};
-          std::array<float, 16> temp{};
+          std::array<float, fgm::depth> temp{};
 
           for (auto inner{outer - vstride - margin},
                icend{outer + vstride - margin};
                inner < icend;
                inner += width - size) {
             for (auto irend{inner + size}; inner < irend; ++inner, ++k) {
-              for (std::uint8_t i{0}; i < 16; ++i) {
-                if ((*outer)[i] > 0.0f) {
-                  temp[i] += (*inner)[i] * *k;
-                }
-              }
+              weigh(map, *inner, present, *k, temp);
             }
           }
 
@@ -297,8 +325,7 @@ namespace details {
               std::max_element(temp.begin(), temp.end()) - temp.begin())};
         }
         else {
-          output[outer - input] = {static_cast<std::uint8_t>(
-              std::max_element(outer->begin(), outer->end()) - outer->begin())};
+          output[outer - input] = {map.dominant(*outer)};
         }
       }
     }
@@ -319,8 +346,9 @@ template<typename Callback, std::uint8_t Size>
            std::integral_constant<std::uint8_t, Size> /*unused*/) {
   auto margins{fragment.margins()};
 
+  all::arena_scope arena{};
   auto heatmap{details::generate_heatmap<Size>(fragment.blend())};
-  auto result{details::blur(fragment.dots(), heatmap, dev)};
+  auto result{details::blur(fragment.cells(), heatmap, dev)};
 
   cb(result, heatmap);
 
@@ -7,7 +7,9 @@
 #include "ifd.hpp"
 #include "sid.hpp"
 
+#include <bit>
 #include <intrin.h>
+#include <limits>
 
 namespace aws {
 
@@ -19,6 +21,10 @@ using frame_type = ifd::frame<image_type>;
 using heatmap_type = sid::mon::dimg_t;
 using contour_type = ctr::contour<cpl::mon_bv, all::frame_allocator<ctr::edge>>;
 
+// pyramid looks for the window on a reduced change mask and grows its
+// region at full resolution
+enum class detection : std::uint8_t { full, pyramid };
+
 namespace details {
 
   template<typename Image>
@@ -34,29 +40,97 @@ namespace details {
                      step_size_v<Mm, Image>;
   }
 
+  // positions of the first and the last heatmap pixel cleared by a compare
+  struct cleared {
+    std::size_t first_{std::numeric_limits<std::size_t>::max()};
+    std::size_t last_{0};
+
+    [[nodiscard]] inline bool empty() const noexcept {
+      return first_ > last_;
+    }
+
+    inline void update(std::size_t first, std::size_t last) noexcept {
+      first_ = std::min(first_, first);
+      last_ = std::max(last_, last);
+    }
+  };
+
   template<typename Image>
-  void compare(Image const& previous,
-               Image const& current,
-               heatmap_type& output) noexcept {
+  cleared compare(Image const& previous,
+                  Image const& current,
+                  heatmap_type& output) noexcept {
     using mm_t = __m256i;
     constexpr auto step{step_size_v<mm_t, Image>};
 
+    cleared result{};
+
     auto o{output.data()};
     auto p{previous.data()}, c{current.data()};
 
     for (auto e{adjust_end<mm_t, Image>(current.end())}; c < e;
          p += step, c += step, o += step) {
-      *reinterpret_cast<mm_t*>(o) = _mm256_and_si256(
-          *reinterpret_cast<mm_t const*>(o),
-          _mm256_cmpeq_epi8(*reinterpret_cast<mm_t const*>(p),
-                            *reinterpret_cast<mm_t const*>(c)));
+      auto heat{*reinterpret_cast<mm_t const*>(o)};
+      auto same{_mm256_cmpeq_epi8(*reinterpret_cast<mm_t const*>(p),
+                                  *reinterpret_cast<mm_t const*>(c))};
+
+      // heat is either 0 or 1, move it to the sign bit for the mask
+      if (auto lost{static_cast<std::uint32_t>(_mm256_movemask_epi8(
+              _mm256_slli_epi16(_mm256_andnot_si256(same, heat), 7)))};
+          lost != 0) {
+        auto base{static_cast<std::size_t>(o - output.data())};
+        result.update(base + std::countr_zero(lost),
+                      base + 31 - std::countl_zero(lost));
+      }
+
+      *reinterpret_cast<mm_t*>(o) = _mm256_and_si256(heat, same);
     }
 
     for (auto e{current.end()}; c < e; ++p, ++c, ++o) {
       if (*p != *c) {
+        if (value(*o) != 0) {
+          auto position{static_cast<std::size_t>(o - output.data())};
+          result.update(position, position);
+        }
+
         *o = {0};
       }
     }
+
+    // the vector loop can run past the end of the image
+    result.last_ = std::min(result.last_, output.size() - 1);
+    return result;
+  }
+
+  // cleared pixels can change the first cold region only if one precedes it
+  // or touches it, since the heatmap only loses pixels
+  template<typename Outline, typename Summary>
+  [[nodiscard]] bool affects(Outline const& outline,
+                             heatmap_type const& heatmap,
+                             Summary const& best,
+                             cleared const& range) noexcept {
+    if (range.empty()) {
+      return false;
+    }
+
+    auto cells{outline.data()};
+    if (value(cells[best.first()].color_) != 0 || range.first_ < best.first()) {
+      return true;
+    }
+
+    auto width{outline.width()};
+    auto id{best.id()};
+
+    auto heat{heatmap.data()};
+    for (auto p{range.first_}; p <= range.last_; ++p) {
+      // horizon cells are always cold in the outline
+      if (value(cells[p].color_) != 0 && value(heat[p]) == 0 &&
+          (cells[p - 1].id_ == id || cells[p + 1].id_ == id ||
+           cells[p - width].id_ == id || cells[p + width].id_ == id)) {
+        return true;
+      }
+    }
+
+    return false;
   }
 
   template<typename Container>
@@ -67,6 +141,301 @@ namespace details {
                  rhs.area() * value(rhs.color());
         });
   }
+
+  // follows the first cold region of a mask that only loses pixels
+  class tracker {
+  public:
+    using extractor_type =
+        cte::extractor<cpl::mon_bv, allocator_t, cte::labeling::runs>;
+    using summary_type = typename extractor_type::summary_type;
+
+  public:
+    inline tracker(mrl::dimensions_t const& dimensions,
+                   allocator_t const& alloc)
+        : extractor_{dimensions, alloc} {
+    }
+
+    contour_type const& update(heatmap_type const& mask,
+                               cleared const& range,
+                               allocator_t const& alloc) {
+      extractor_.reset(alloc);
+      if (!best_ || affects(extractor_.outline(), mask, *best_, range)) {
+        best_ = get_best(extractor_.summarize(
+            mask, [](auto px, auto idx) { return value(px) != 0xff; }));
+        contour_ = extractor_.gather(*best_);
+      }
+      else {
+        // edges have to outlive the memory of the previous frame
+        contour_ = contour_type{*contour_, alloc};
+      }
+
+      return *contour_;
+    }
+
+  private:
+    extractor_type extractor_;
+
+    std::optional<summary_type> best_{};
+    std::optional<contour_type> contour_{};
+  };
+
+  // bounds of the window and the number of cold pixels it holds
+  struct estimate {
+    ctr::region_t bounds_;
+    std::size_t area_;
+  };
+
+  // change mask reduced by scale, a cell is cold if any of its pixels is, the
+  // mask is padded so that the horizon does not cover any block
+  class pyramid {
+  public:
+    static inline constexpr std::size_t scale{4};
+
+  public:
+    inline explicit pyramid(mrl::dimensions_t const& dimensions)
+        : mask_{{(dimensions.width_ + scale - 1) / scale + 2,
+                 (dimensions.height_ + scale - 1) / scale + 3},
+                {1}}
+        , visited_{dimensions} {
+    }
+
+    [[nodiscard]] inline heatmap_type const& mask() const noexcept {
+      return mask_;
+    }
+
+    // only blocks that are still hot in the rows of the cleared range are
+    // checked
+    [[nodiscard]] cleared reduce(heatmap_type const& heatmap,
+                                 cleared const& range) noexcept {
+      cleared result{};
+      if (range.empty()) {
+        return result;
+      }
+
+      auto width{heatmap.width()};
+      auto cells{mask_.data()};
+
+      for (auto y{range.first_ / width / scale},
+           last{range.last_ / width / scale};
+           y <= last;
+           ++y) {
+        for (std::size_t x{0}; x * scale < width; ++x) {
+          auto position{(y + 1) * mask_.width() + x + 1};
+          if (value(cells[position]) != 0 &&
+              cold(heatmap, x * scale, y * scale)) {
+            cells[position] = {0};
+            result.update(position, position);
+          }
+        }
+      }
+
+      return result;
+    }
+
+    // the window is the full resolution region grown from the first cold
+    // pixel in the blocks of the candidate, cold pixels separated from it by
+    // static strips narrower than a block are left out
+    //
+    // the whole region is filled, since connectivity cannot be decided from
+    // the bands along the edges alone, and it can differ from the region full
+    // detection picks, the first cold block in reduced order need not hold
+    // the first cold pixel in full order
+    [[nodiscard]] std::optional<estimate> const&
+        window(heatmap_type const& heatmap,
+               ctr::region_t const& candidate,
+               cleared const& range) {
+      if (auto box{blocks(heatmap, candidate)};
+          !window_ || !same(box, box_) || !extend(heatmap, range)) {
+        box_ = box;
+        window_ = refine(heatmap);
+      }
+
+      return window_;
+    }
+
+  private:
+    // pixels covered by the blocks of the candidate, limited to the same
+    // interior as the full resolution extractor
+    [[nodiscard]] static ctr::region_t
+        blocks(heatmap_type const& heatmap,
+               ctr::region_t const& candidate) noexcept {
+      return {std::max<std::size_t>((candidate.left_ - 1) * scale, 1),
+              std::max<std::size_t>((candidate.top_ - 1) * scale, 1),
+              std::min(candidate.right_ * scale, heatmap.width() - 1),
+              std::min(candidate.bottom_ * scale, heatmap.height() - 2)};
+    }
+
+    [[nodiscard]] static inline bool same(ctr::region_t const& lhs,
+                                          ctr::region_t const& rhs) noexcept {
+      return lhs.left_ == rhs.left_ && lhs.top_ == rhs.top_ &&
+             lhs.right_ == rhs.right_ && lhs.bottom_ == rhs.bottom_;
+    }
+
+    // cold pixels only accumulate, so the window grows from cleared pixels
+    // next to it, it has to be found again if one of them precedes the pixel
+    // it was found from
+    [[nodiscard]] bool extend(heatmap_type const& heatmap,
+                              cleared const& range) {
+      if (range.empty()) {
+        return true;
+      }
+
+      auto width{heatmap.width()};
+      auto visited{visited_.data()};
+
+      pending_.clear();
+      for (auto y{std::max(range.first_ / width, box_.top_)},
+           last{std::min(range.last_ / width + 1, box_.bottom_)};
+           y < last;
+           ++y) {
+        auto row{y * width};
+        for (auto p{std::max(row + box_.left_, range.first_)},
+             end{std::min(row + box_.right_, range.last_ + 1)};
+             p < end;
+             ++p) {
+          if (!open(heatmap, p)) {
+            continue;
+          }
+
+          if (p < seed_) {
+            return false;
+          }
+
+          if (visited[p - 1] == stamp_ || visited[p + 1] == stamp_ ||
+              visited[p - width] == stamp_ || visited[p + width] == stamp_) {
+            pending_.push_back(p);
+          }
+        }
+      }
+
+      fill(heatmap, *window_);
+      return true;
+    }
+
+    [[nodiscard]] std::optional<estimate> refine(heatmap_type const& heatmap) {
+      auto width{heatmap.width()};
+      auto heat{heatmap.data()};
+
+      std::optional<std::size_t> seed{};
+      for (auto y{box_.top_}; !seed && y < box_.bottom_; ++y) {
+        auto row{heat + y * width};
+        if (auto found{std::find_if(row + box_.left_,
+                                    row + box_.right_,
+                                    [](auto px) { return value(px) == 0; })};
+            found != row + box_.right_) {
+          seed = static_cast<std::size_t>(found - heat);
+        }
+      }
+
+      if (!seed) {
+        return {};
+      }
+
+      if (++stamp_ == 0) {
+        std::fill(visited_.data(), visited_.end(), std::uint8_t{0});
+        stamp_ = 1;
+      }
+
+      seed_ = *seed;
+
+      estimate result{{box_.right_, box_.bottom_, 0, 0}, 0};
+
+      pending_.clear();
+      pending_.push_back(seed_);
+      fill(heatmap, result);
+
+      return result;
+    }
+
+    // scanline fill of pending pixels, limited to the blocks
+    void fill(heatmap_type const& heatmap, estimate& result) {
+      auto width{heatmap.width()};
+      auto visited{visited_.data()};
+
+      auto& bounds{result.bounds_};
+
+      while (!pending_.empty()) {
+        auto position{pending_.back()};
+        pending_.pop_back();
+
+        if (visited[position] == stamp_) {
+          continue;
+        }
+
+        auto y{position / width}, row{y * width};
+
+        auto first{position}, last{position + 1};
+        for (; first > row + box_.left_ && open(heatmap, first - 1); --first) {
+        }
+
+        for (; last < row + box_.right_ && open(heatmap, last); ++last) {
+        }
+
+        std::fill(visited + first, visited + last, stamp_);
+
+        result.area_ += last - first;
+        bounds.left_ = std::min(bounds.left_, first - row);
+        bounds.top_ = std::min(bounds.top_, y);
+        bounds.right_ = std::max(bounds.right_, last - 1 - row);
+        bounds.bottom_ = std::max(bounds.bottom_, y);
+
+        // pushes the first pixel of each open run in the neighbouring rows
+        auto spread{[&](std::size_t other) {
+          for (auto p{first - row + other}, end{last - row + other}; p < end;
+               ++p) {
+            if (open(heatmap, p) &&
+                (p == first - row + other || !open(heatmap, p - 1))) {
+              pending_.push_back(p);
+            }
+          }
+        }};
+
+        if (y > box_.top_) {
+          spread(row - width);
+        }
+
+        if (y + 1 < box_.bottom_) {
+          spread(row + width);
+        }
+      }
+    }
+
+    // cold and not yet part of the window
+    [[nodiscard]] inline bool open(heatmap_type const& heatmap,
+                                   std::size_t position) const noexcept {
+      return value(heatmap.data()[position]) == 0 &&
+             visited_.data()[position] != stamp_;
+    }
+
+    [[nodiscard]] inline bool cold(heatmap_type const& heatmap,
+                                   std::size_t x,
+                                   std::size_t y) const noexcept {
+      auto width{heatmap.width()};
+      auto right{std::min(x + scale, width)};
+
+      for (auto last{std::min(y + scale, heatmap.height())}; y < last; ++y) {
+        auto row{heatmap.data() + y * width};
+        if (std::any_of(row + x, row + right, [](auto px) {
+              return value(px) == 0;
+            })) {
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+  private:
+    heatmap_type mask_;
+
+    mrl::matrix<std::uint8_t> visited_;
+    std::uint8_t stamp_{0};
+    std::size_t seed_{0};
+    std::vector<std::size_t> pending_{};
+
+    ctr::region_t box_{};
+    std::optional<estimate> window_{};
+  };
 } // namespace details
 
 class window_info {
@@ -95,13 +464,72 @@ private:
   mrl::region_t margins_;
 };
 
+class recorder {
+public:
+  inline explicit recorder(std::size_t limit) noexcept
+      : limit_{limit} {
+  }
+
+  void operator()(std::size_t number, image_type const& image) {
+    if (overflow_) {
+      return;
+    }
+
+    if (frames_.size() == limit_) {
+      overflow_ = true;
+      frames_ = {};
+    }
+    else {
+      frames_.push_back(
+          {number, image.crop({}, std::allocator<cpl::nat_cc>{})});
+    }
+  }
+
+  [[nodiscard]] inline bool complete() const noexcept {
+    return !overflow_;
+  }
+
+  [[nodiscard]] inline ifd::recording_t release() noexcept {
+    return std::move(frames_);
+  }
+
+private:
+  std::size_t limit_;
+  bool overflow_{false};
+
+  ifd::recording_t frames_;
+};
+
 template<typename Feeder, typename Callback>
-[[nodiscard]] std::optional<window_info> scan(
+[[nodiscard]] inline std::optional<window_info> scan(
     Feeder&& feed,
     mrl::dimensions_t const& dimensions,
-    Callback&& cb) requires(ifd::feeder<std::decay_t<Feeder>, allocator_t>) {
-  auto mask{[](auto px, auto idx) { return value(px) != 0xff; }};
+    Callback&& cb,
+    detection selected =
+        detection::full) requires(ifd::feeder<std::decay_t<Feeder>,
+                                              allocator_t>) {
+  return scan(
+      std::forward<Feeder>(feed),
+      dimensions,
+      std::forward<Callback>(cb),
+      [](std::size_t /*unused*/, image_type const& /*unused*/) noexcept {},
+      selected);
+}
 
+// cb always gets the full resolution heatmap, in pyramid mode the contour is
+// the one tracked on the reduced mask, in its coordinates
+template<typename Feeder, typename Callback, typename Recorder>
+[[nodiscard]] std::optional<window_info> scan(
+    Feeder&& feed,
+    mrl::dimensions_t const& dimensions,
+    Callback&& cb,
+    Recorder&& record,
+    detection selected =
+        detection::full) requires(ifd::feeder<std::decay_t<Feeder>,
+                                              allocator_t>&&
+                                      std::invocable<Recorder,
+                                                     std::size_t,
+                                                     image_type const&>) {
   std::optional<mrl::region_t> result{};
   if (!feed.has_more()) {
     return {};
@@ -115,26 +543,43 @@ template<typename Feeder, typename Callback>
 
   all::memory_stack<cpl::nat_cc> memory{};
   auto [pno, pimage]{feed.produce(memory.previous())};
+  record(pno, pimage);
+
+  std::optional<details::pyramid> pyramid{};
+  if (selected == detection::pyramid) {
+    pyramid.emplace(dimensions);
+  }
+
+  details::tracker tracker{
+      pyramid ? pyramid->mask().dimensions() : dimensions, memory.previous()};
+
   for (std::size_t area{}, stagnation{};
        feed.has_more() && stagnation <= 100;) {
     all::memory_swing swing{memory};
 
     auto current{feed.produce(swing.get())};
+    record(current.number_, current.image_);
 
-    details::compare(pimage, current.image_, heatmap);
-    cte::extractor<cpl::mon_bv, allocator_t> extractor{dimensions, swing};
+    auto cleared{details::compare(pimage, current.image_, heatmap)};
 
-    auto contour{details::get_best(extractor.extract(heatmap, mask))};
+    auto& contour{pyramid ? tracker.update(pyramid->mask(),
+                                           pyramid->reduce(heatmap, cleared),
+                                           swing)
+                          : tracker.update(heatmap, cleared, swing)};
 
     if (value(contour.color()) == 0) {
-      if (contour.area() > area) {
+      auto window{pyramid
+                      ? pyramid->window(heatmap, contour.enclosure(), cleared)
+                      : details::estimate{contour.enclosure(), contour.area()}};
+
+      if (window && window->area_ > area) {
         stagnation = 0;
-        area = contour.area();
+        area = window->area_;
 
-        if (auto window{contour.enclosure()};
-            result || area > min_area && window.height() > min_height &&
-                          window.width() > min_width) {
-          result = window;
+        auto& bounds{window->bounds_};
+        if (result || area > min_area && bounds.height() > min_height &&
+                          bounds.width() > min_width) {
+          result = bounds;
         }
       }
     }
@@ -0,0 +1,360 @@
+// capture archive
+
+#pragma once
+
+#include "ifd.hpp"
+#include "pfd.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cca {
+
+inline constexpr std::uint32_t signature{0x4143524d}; // "MRCA"
+inline constexpr std::uint16_t version{1};
+
+enum class encoding : std::uint16_t { raw = 0, nibble = 1 };
+
+struct header {
+  std::uint32_t signature_;
+  std::uint16_t version_;
+  encoding encoding_;
+  std::uint32_t width_;
+  std::uint32_t height_;
+  std::uint64_t count_;
+};
+
+static_assert(sizeof(header) == 24);
+
+using index_entry = std::uint64_t;
+
+using payload_t = std::span<std::uint8_t const>;
+
+namespace details {
+  [[nodiscard]] inline std::size_t
+      payload_size(mrl::dimensions_t const& dimensions,
+                   encoding enc) noexcept {
+    auto area{dimensions.area()};
+    return enc == encoding::nibble ? (area >> 1) + (area & 1) : area;
+  }
+
+  inline void pack(cpl::nat_cc const* first,
+                   cpl::nat_cc const* last,
+                   std::uint8_t* output) noexcept {
+    for (; last - first > 1; first += 2, ++output) {
+      *output = static_cast<std::uint8_t>((value(first[0]) << 4) |
+                                          (value(first[1]) & 0x0f));
+    }
+
+    if (first < last) {
+      *output = static_cast<std::uint8_t>(value(*first) << 4);
+    }
+  }
+
+  inline void unpack(std::uint8_t const* input,
+                     std::size_t position,
+                     std::size_t count,
+                     cpl::nat_cc* output) noexcept {
+    auto src{input + (position >> 1)};
+    auto last{output + count};
+
+    if ((position & 1) != 0 && output < last) {
+      *(output++) = {static_cast<std::uint8_t>(*(src++) & 0x0f)};
+    }
+
+    for (; last - output > 1; ++src) {
+      *(output++) = {static_cast<std::uint8_t>(*src >> 4)};
+      *(output++) = {static_cast<std::uint8_t>(*src & 0x0f)};
+    }
+
+    if (output < last) {
+      *output = {static_cast<std::uint8_t>(*src >> 4)};
+    }
+  }
+
+  class mapping {
+  public:
+    explicit mapping(std::filesystem::path const& path) {
+#ifdef _WIN32
+      file_ = ::CreateFileW(path.c_str(),
+                            GENERIC_READ,
+                            FILE_SHARE_READ,
+                            nullptr,
+                            OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN,
+                            nullptr);
+      if (file_ == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error{"cannot open capture archive"};
+      }
+
+      LARGE_INTEGER size{};
+      if (!::GetFileSizeEx(file_, &size)) {
+        ::CloseHandle(file_);
+        throw std::runtime_error{"cannot open capture archive"};
+      }
+
+      size_ = static_cast<std::size_t>(size.QuadPart);
+
+      map_ = ::CreateFileMappingW(
+          file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      if (map_ == nullptr) {
+        ::CloseHandle(file_);
+        throw std::runtime_error{"cannot map capture archive"};
+      }
+
+      data_ = static_cast<std::uint8_t const*>(
+          ::MapViewOfFile(map_, FILE_MAP_READ, 0, 0, 0));
+#else
+      auto fd{::open(path.c_str(), O_RDONLY)};
+      if (fd < 0) {
+        throw std::runtime_error{"cannot open capture archive"};
+      }
+
+      struct stat info {};
+      if (::fstat(fd, &info) != 0) {
+        ::close(fd);
+        throw std::runtime_error{"cannot open capture archive"};
+      }
+
+      size_ = static_cast<std::size_t>(info.st_size);
+
+      auto data{::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0)};
+      ::close(fd);
+
+      if (data != MAP_FAILED) {
+        ::madvise(data, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<std::uint8_t const*>(data);
+      }
+#endif
+
+      if (data_ == nullptr) {
+        release();
+        throw std::runtime_error{"cannot map capture archive"};
+      }
+    }
+
+    ~mapping() {
+      release();
+    }
+
+    mapping(mapping const&) = delete;
+    mapping& operator=(mapping const&) = delete;
+
+    [[nodiscard]] inline std::uint8_t const* data() const noexcept {
+      return data_;
+    }
+
+    [[nodiscard]] inline std::size_t size() const noexcept {
+      return size_;
+    }
+
+  private:
+    void release() noexcept {
+#ifdef _WIN32
+      if (data_ != nullptr) {
+        ::UnmapViewOfFile(data_);
+      }
+
+      if (map_ != nullptr) {
+        ::CloseHandle(map_);
+      }
+
+      if (file_ != INVALID_HANDLE_VALUE) {
+        ::CloseHandle(file_);
+      }
+#else
+      if (data_ != nullptr) {
+        ::munmap(const_cast<std::uint8_t*>(data_), size_);
+      }
+#endif
+    }
+
+  private:
+#ifdef _WIN32
+    HANDLE file_{INVALID_HANDLE_VALUE};
+    HANDLE map_{nullptr};
+#endif
+
+    std::uint8_t const* data_{nullptr};
+    std::size_t size_{0};
+  };
+} // namespace details
+
+class archive {
+public:
+  explicit archive(std::filesystem::path const& path)
+      : mapping_{path} {
+    if (mapping_.size() < sizeof(header)) {
+      throw std::runtime_error{"invalid capture archive"};
+    }
+
+    header_ = reinterpret_cast<header const*>(mapping_.data());
+    if (header_->signature_ != signature || header_->version_ != version) {
+      throw std::runtime_error{"invalid capture archive"};
+    }
+
+    index_ = reinterpret_cast<index_entry const*>(header_ + 1);
+
+    validate_index();
+  }
+
+  [[nodiscard]] inline mrl::dimensions_t dimensions() const noexcept {
+    return {header_->width_, header_->height_};
+  }
+
+  [[nodiscard]] inline std::size_t size() const noexcept {
+    return static_cast<std::size_t>(header_->count_);
+  }
+
+  [[nodiscard]] inline encoding get_encoding() const noexcept {
+    return header_->encoding_;
+  }
+
+  [[nodiscard]] inline payload_t view(std::size_t index) const noexcept {
+    return {mapping_.data() + index_[index],
+            details::payload_size(dimensions(), header_->encoding_)};
+  }
+
+private:
+  // frames have to follow the index in order without overlapping and fit in
+  // the mapping, bounds are compared without overflowing
+  void validate_index() const {
+    auto available{mapping_.size() - sizeof(header)};
+    if (header_->count_ > available / sizeof(index_entry)) {
+      throw std::runtime_error{"truncated capture archive"};
+    }
+
+    auto count{static_cast<std::size_t>(header_->count_)};
+    auto payload{details::payload_size(dimensions(), header_->encoding_)};
+
+    std::uint64_t next{sizeof(header) + count * sizeof(index_entry)};
+    for (std::size_t i{0}; i < count; ++i) {
+      if (index_[i] < next || index_[i] > mapping_.size() ||
+          mapping_.size() - index_[i] < payload) {
+        throw std::runtime_error{"truncated capture archive"};
+      }
+
+      next = index_[i] + payload;
+    }
+  }
+
+private:
+  details::mapping mapping_;
+
+  header const* header_;
+  index_entry const* index_;
+};
+
+template<pfd::reader Reader>
+void write(std::filesystem::path const& path,
+           mrl::dimensions_t const& dimensions,
+           Reader& reader,
+           encoding enc = encoding::nibble) {
+  std::ofstream output{path, std::ios::out | std::ios::binary};
+
+  auto count{static_cast<std::uint64_t>(reader.size())};
+  header head{signature,
+              version,
+              enc,
+              static_cast<std::uint32_t>(dimensions.width_),
+              static_cast<std::uint32_t>(dimensions.height_),
+              count};
+
+  output.write(reinterpret_cast<char const*>(&head), sizeof(head));
+
+  auto payload{details::payload_size(dimensions, enc)};
+  auto offset{sizeof(header) + count * sizeof(index_entry)};
+  for (std::uint64_t i{0}; i < count; ++i, offset += payload) {
+    index_entry entry{offset};
+    output.write(reinterpret_cast<char const*>(&entry), sizeof(entry));
+  }
+
+  std::vector<cpl::nat_cc> frame(dimensions.area());
+  std::vector<std::uint8_t> packed(payload);
+
+  for (std::size_t i{0}; i < count; ++i) {
+    reader(i, frame.data());
+
+    if (enc == encoding::nibble) {
+      details::pack(frame.data(), frame.data() + frame.size(), packed.data());
+      output.write(reinterpret_cast<char const*>(packed.data()), payload);
+    }
+    else {
+      output.write(reinterpret_cast<char const*>(frame.data()), payload);
+    }
+  }
+}
+
+class feed {
+public:
+  inline explicit feed(std::shared_ptr<archive const> source,
+                       std::optional<mrl::region_t> crop = {})
+      : source_{std::move(source)}
+      , crop_{crop.value_or(mrl::region_t{})} {
+  }
+
+  [[nodiscard]] inline bool has_more() const noexcept {
+    return next_ < source_->size();
+  }
+
+  inline void crop(mrl::region_t const& region) noexcept {
+    crop_ = region;
+  }
+
+  template<typename Alloc>
+  [[nodiscard]] auto produce(Alloc const& alloc) {
+    using image_type = sid::nat::aimg_t<Alloc>;
+    using frame_type = ifd::frame<image_type>;
+
+    auto dimensions{source_->dimensions()};
+    auto margins{crop_.margins()};
+
+    image_type image{{dimensions.width_ - margins.x_,
+                      dimensions.height_ - margins.y_},
+                     alloc};
+
+    auto payload{source_->view(next_)};
+    if (source_->get_encoding() == encoding::nibble) {
+      auto width{image.width()};
+      auto position{crop_.top_ * dimensions.width_ + crop_.left_};
+
+      for (auto dst{image.data()}, last{image.end()}; dst < last;
+           dst += width, position += dimensions.width_) {
+        details::unpack(payload.data(), position, width, dst);
+      }
+    }
+    else {
+      pfd::details::copy(reinterpret_cast<cpl::nat_cc const*>(payload.data()),
+                         dimensions,
+                         crop_,
+                         image);
+    }
+
+    return frame_type{next_++, std::move(image)};
+  }
+
+private:
+  std::shared_ptr<archive const> source_;
+  mrl::region_t crop_;
+
+  std::size_t next_{0};
+};
+
+} // namespace cca
@@ -7,30 +7,109 @@
 #include "ctr.hpp"
 #include "mrl.hpp"
 
+#include <concepts>
 #include <deque>
+#include <limits>
 #include <queue>
 
 namespace cte {
 
-inline constexpr std::uint16_t horizon_id{0xffff};
+// narrow ids keep the outline compact, wide ones are meant for large images
+// such as whole stitched maps that can hold more than 65534 contours
+using narrow_id = std::uint16_t;
+using wide_id = std::uint32_t;
 
-template<cpl::pixel Ty>
+template<std::unsigned_integral Id>
+inline constexpr Id horizon_v{std::numeric_limits<Id>::max()};
+
+inline constexpr std::uint16_t horizon_id{horizon_v<narrow_id>};
+
+// flood fill walks each contour from its seed, runs labels row segments of
+// equal color and joins them with union-find in two passes
+enum class labeling { flood, runs };
+
+template<cpl::pixel Ty, std::unsigned_integral Id = narrow_id>
 struct cell {
   using pixel_type = Ty;
-  using id_type = std::uint16_t;
+  using id_type = Id;
+
+  static inline constexpr id_type horizon{horizon_v<id_type>};
 
   id_type id_;
   pixel_type color_;
   ctr::edge_side edge_;
 };
 
+template<cpl::pixel Ty, std::unsigned_integral Id = narrow_id>
+using outline_t = mrl::matrix<cell<Ty, Id>>;
+
+// area and bounds of a labeled contour, its edges can be gathered later from
+// the outline
 template<cpl::pixel Ty>
-using outline_t = mrl::matrix<cell<Ty>>;
+class summary {
+public:
+  using pixel_type = Ty;
+
+public:
+  inline summary(pixel_type const* base, std::uint32_t id) noexcept
+      : base_{base}
+      , id_{id} {
+  }
+
+  inline void add_point(pixel_type const* point,
+                        ctr::edge_side /*unused*/) noexcept {
+    auto position{static_cast<std::uint32_t>(point - base_)};
+    if (area_++ == 0) {
+      first_ = last_ = position;
+    }
+    else {
+      first_ = std::min(first_, position);
+      last_ = std::max(last_, position);
+    }
+  }
+
+  [[nodiscard]] inline pixel_type const* base() const noexcept {
+    return base_;
+  }
+
+  [[nodiscard]] inline std::uint32_t area() const noexcept {
+    return area_;
+  }
+
+  [[nodiscard]] inline std::uint32_t id() const noexcept {
+    return id_;
+  }
+
+  [[nodiscard]] inline std::uint32_t first() const noexcept {
+    return first_;
+  }
+
+  [[nodiscard]] inline std::uint32_t last() const noexcept {
+    return last_;
+  }
+
+  [[nodiscard]] inline pixel_type color() const noexcept {
+    return base_[first_];
+  }
+
+private:
+  pixel_type const* base_;
+
+  std::uint32_t area_{0};
+  std::uint32_t id_;
 
-template<cpl::pixel Ty, typename Alloc = std::allocator<ctr::edge>>
+  std::uint32_t first_{0};
+  std::uint32_t last_{0};
+};
+
+template<cpl::pixel Ty,
+         typename Alloc = std::allocator<ctr::edge>,
+         labeling Engine = labeling::flood,
+         std::unsigned_integral Id = narrow_id>
 class extractor {
 public:
   using pixel_type = Ty;
+  using id_type = Id;
   using allocator_type = Alloc;
   using contour_type =
       ctr::contour<pixel_type, all::rebind_alloc_t<allocator_type, ctr::edge>>;
@@ -39,24 +118,53 @@ public:
       std::vector<contour_type,
                   all::rebind_alloc_t<allocator_type, contour_type>>;
 
-  using cell_type = cell<pixel_type>;
+  using summary_type = summary<pixel_type>;
+  using summaries =
+      std::vector<summary_type,
+                  all::rebind_alloc_t<allocator_type, summary_type>>;
+
+  using cell_type = cell<pixel_type, id_type>;
   static_assert(std::is_trivially_copyable_v<cell_type>);
 
-  using outline_type = outline_t<pixel_type>;
+  using outline_type = outline_t<pixel_type, id_type>;
+
+  static inline constexpr std::size_t max_contours{cell_type::horizon - 1};
 
 private:
   using path_node = pixel_type const*;
   using path_type = std::queue<path_node, std::deque<path_node>>;
 
+  struct run {
+    std::uint32_t first_;
+    std::uint32_t last_;
+    std::uint32_t parent_;
+  };
+
+  using runs_type =
+      std::vector<run, all::rebind_alloc_t<allocator_type, run>>;
+  using labels_type =
+      std::vector<std::uint32_t,
+                  all::rebind_alloc_t<allocator_type, std::uint32_t>>;
+
 public:
   explicit inline extractor(mrl::dimensions_t dimensions,
                             allocator_type const& alloc = allocator_type{})
       : allocator_{alloc}
       , outline_{dimensions}
-      , path_{} {
+      , path_{}
+      , runs_{alloc}
+      , labels_{alloc} {
   }
 
 public:
+  // keeps the outline and replaces the allocator used by subsequent calls,
+  // memory obtained from the previous one is no longer referenced
+  inline void reset(allocator_type const& alloc) {
+    allocator_ = alloc;
+    runs_ = runs_type{alloc};
+    labels_ = labels_type{alloc};
+  }
+
   [[nodiscard]] inline contours extract(mrl::matrix<pixel_type> const& image) {
     return extract(image, [](auto px, auto idx) { return true; });
   }
@@ -64,52 +172,99 @@ public:
   template<std::predicate<pixel_type, std::size_t> Pred>
   [[nodiscard]] contours extract(mrl::matrix<pixel_type> const& image,
                                  Pred pred) {
-    clear_outline();
-
     contours extracted{allocator_};
-    for (auto position{image.data() + image.width() + 1},
-         last{image.end() - image.width() + 1};
-         position < last;
-         position += image.width()) {
+    assign_labels(image, extracted, pred);
 
-      process_row(image.data(), position, extracted, pred);
-    }
+    return extracted;
+  }
+
+  // labels the outline like extract, but without recording contour edges
+  template<std::predicate<pixel_type, std::size_t> Pred>
+  [[nodiscard]] summaries summarize(mrl::matrix<pixel_type> const& image,
+                                    Pred pred) {
+    summaries extracted{allocator_};
+    assign_labels(image, extracted, pred);
 
     return extracted;
   }
 
+  // rebuilds the contour of a summary from the current outline
+  [[nodiscard]] contour_type gather(summary_type const& target) const {
+    auto outline{outline_.data()};
+
+    contour_type result{
+        target.base(), outline_.width(), target.id(), allocator_};
+
+    for (auto p{target.first()}, last{target.last()}; p <= last; ++p) {
+      if (outline[p].id_ == target.id()) {
+        result.add_point(target.base() + p, outline[p].edge_);
+      }
+    }
+
+    return result;
+  }
+
   [[nodiscard]] outline_type const& outline() const noexcept {
     return outline_;
   }
 
 private:
-  template<typename Pred>
+  template<typename Output, typename Pred>
+  void assign_labels(mrl::matrix<pixel_type> const& image,
+                     Output& output,
+                     Pred& pred) {
+    clear_outline();
+
+    if constexpr (Engine == labeling::runs) {
+      label_runs(image.data(), output, pred);
+    }
+    else {
+      for (auto position{image.data() + image.width() + 1},
+           last{image.end() - image.width() + 1};
+           position < last;
+           position += image.width()) {
+
+        process_row(image.data(), position, output, pred);
+      }
+    }
+  }
+
+  inline contour_type&
+      open(contours& output, pixel_type const* image, std::uint32_t id) {
+    return output.emplace_back(image, outline_.width(), id, allocator_);
+  }
+
+  inline summary_type&
+      open(summaries& output, pixel_type const* image, std::uint32_t id) {
+    return output.emplace_back(image, id);
+  }
+
+  template<typename Output, typename Pred>
   inline void process_row(pixel_type const* image,
                           pixel_type const* pos,
-                          contours& output,
+                          Output& output,
                           Pred& pred) {
     auto outline{outline_.data()};
 
-    for (auto last{pos + outline_.width() - 2}; pos < last; ++pos) {
+    for (auto last{pos + outline_.width() - 2};
+         pos < last && !exhausted(output);
+         ++pos) {
       if (auto p{pos - image}; outline[p].id_ == 0 && pred(*pos, p)) {
-        output.push_back(extract_single(
-            image,
-            pos,
-            static_cast<typename cell_type::id_type>(output.size() + 1)));
+        extract_single(image, pos, open(output, image, next_id(output)));
       }
     }
   }
 
-  [[nodiscard]] contour_type extract_single(pixel_type const* image,
-                                            pixel_type const* position,
-                                            std::uint32_t id) {
+  template<typename Sink>
+  void extract_single(pixel_type const* image,
+                      pixel_type const* position,
+                      Sink& result) {
     auto width{outline_.width()};
     auto outline{outline_.data()};
-
-    contour_type result{image, width, id, allocator_};
+    auto id{result.id()};
 
     path_.push(position);
-    outline[(position - image)].id_ = id;
+    outline[(position - image)].id_ = static_cast<id_type>(id);
 
     while (!path_.empty()) {
       auto pixel{path_.front()};
@@ -125,8 +280,150 @@ private:
 
       path_.pop();
     }
+  }
 
-    return result;
+  template<typename Output, typename Pred>
+  void label_runs(pixel_type const* image, Output& output, Pred& pred) {
+    auto width{static_cast<std::uint32_t>(outline_.width())};
+    auto height{static_cast<std::uint32_t>(outline_.height())};
+
+    runs_.clear();
+
+    std::uint32_t previous{0};
+    // the last two rows belong to the horizon, see clear_outline
+    for (std::uint32_t y{1}; y + 2 < height; ++y) {
+      auto current{static_cast<std::uint32_t>(runs_.size())};
+      split_row(image, y * width + 1, (y + 1) * width - 1);
+
+      if (y > 1) {
+        join_rows(image, previous, current, width);
+      }
+
+      previous = current;
+    }
+
+    labels_.assign(runs_.size(), 0);
+    for (std::uint32_t i{0}; i < runs_.size() && !exhausted(output); ++i) {
+      if (auto& label{labels_[find(i)]}; label == 0) {
+        for (auto p{runs_[i].first_}; p < runs_[i].last_; ++p) {
+          if (pred(image[p], p)) {
+            label = open(output, image, next_id(output)).id();
+            break;
+          }
+        }
+      }
+    }
+
+    for (std::uint32_t i{0}; i < runs_.size(); ++i) {
+      if (auto label{labels_[find(i)]}; label != 0) {
+        fill_run(image, runs_[i], label, output[label - 1]);
+      }
+    }
+  }
+
+  void split_row(pixel_type const* image,
+                 std::uint32_t first,
+                 std::uint32_t last) {
+    while (first < last) {
+      auto color{image[first]};
+
+      auto end{first + 1};
+      while (end < last && image[end] == color) {
+        ++end;
+      }
+
+      runs_.push_back({first, end, static_cast<std::uint32_t>(runs_.size())});
+      first = end;
+    }
+  }
+
+  // unites runs of the previous row with overlapping runs of the same color
+  // in the current one
+  void join_rows(pixel_type const* image,
+                 std::uint32_t previous,
+                 std::uint32_t current,
+                 std::uint32_t width) {
+    auto end{static_cast<std::uint32_t>(runs_.size())};
+    for (auto i{previous}, j{current}; i < current && j < end;) {
+      auto& upper{runs_[i]};
+      auto& lower{runs_[j]};
+
+      if (image[upper.first_] == image[lower.first_] &&
+          upper.first_ + width < lower.last_ &&
+          lower.first_ < upper.last_ + width) {
+        unite(i, j);
+      }
+
+      auto upper_end{upper.last_ + width};
+      if (upper_end <= lower.last_) {
+        ++i;
+      }
+
+      if (lower.last_ <= upper_end) {
+        ++j;
+      }
+    }
+  }
+
+  [[nodiscard]] std::uint32_t find(std::uint32_t index) noexcept {
+    while (runs_[index].parent_ != index) {
+      auto& parent{runs_[index].parent_};
+      parent = runs_[parent].parent_;
+      index = parent;
+    }
+
+    return index;
+  }
+
+  void unite(std::uint32_t left, std::uint32_t right) noexcept {
+    left = find(left);
+    right = find(right);
+
+    if (left < right) {
+      runs_[right].parent_ = left;
+    }
+    else if (right < left) {
+      runs_[left].parent_ = right;
+    }
+  }
+
+  template<typename Sink>
+  void fill_run(pixel_type const* image,
+                run const& segment,
+                std::uint32_t id,
+                Sink& contour) {
+    auto width{outline_.width()};
+    auto outline{outline_.data()};
+
+    // rows next to the horizon have it on their outer side
+    auto y{segment.first_ / width};
+    auto top{y == 1}, bottom{y + 3 == outline_.height()};
+
+    for (auto p{segment.first_}; p < segment.last_; ++p) {
+      auto pixel{image + p};
+      auto cell{outline + p};
+
+      cell->id_ = static_cast<id_type>(id);
+      cell->color_ = *pixel;
+      cell->edge_ = ctr::create_edge(p == segment.first_,
+                                     p + 1 == segment.last_,
+                                     top || *(pixel - width) != *pixel,
+                                     bottom || *(pixel + width) != *pixel);
+
+      contour.add_point(pixel, cell->edge_);
+    }
+  }
+
+  // ids that would reach the horizon would merge contours with the border,
+  // regions found once ids run out are left unlabeled
+  template<typename Output>
+  [[nodiscard]] static inline bool exhausted(Output const& output) noexcept {
+    return output.size() >= max_contours;
+  }
+
+  template<typename Output>
+  [[nodiscard]] static inline id_type next_id(Output const& output) noexcept {
+    return static_cast<id_type>(output.size() + 1);
   }
 
   bool push_pixel(pixel_type const* pixel,
@@ -136,11 +433,11 @@ private:
     if (auto n_pixel{pixel + offset}; *n_pixel == *pixel) {
       auto n_cell{cell + offset};
       if (n_cell->id_ == 0) {
-        n_cell->id_ = id;
+        n_cell->id_ = static_cast<id_type>(id);
         path_.push(n_pixel);
       }
 
-      return n_cell->id_ == horizon_id;
+      return n_cell->id_ == cell_type::horizon;
     }
 
     return true;
@@ -149,7 +446,7 @@ private:
   void clear_outline() noexcept {
     auto first{outline_.data()};
     for (auto last{outline_.data() + outline_.width()}; first < last; ++first) {
-      *first = {.id_ = horizon_id};
+      *first = {.id_ = cell_type::horizon};
     }
 
     auto size{outline_.width() * (outline_.height() - 2)};
@@ -157,11 +454,11 @@ private:
 
     for (auto last{first + size - 2 * outline_.width()}; first <= last;
          first += outline_.width()) {
-      *first = *(first + outline_.width() - 1) = {.id_ = horizon_id};
+      *first = *(first + outline_.width() - 1) = {.id_ = cell_type::horizon};
     }
 
     for (auto last{outline_.end()}; first < last; ++first) {
-      *first = {.id_ = horizon_id};
+      *first = {.id_ = cell_type::horizon};
     }
   }
 
@@ -170,6 +467,9 @@ private:
 
   outline_type outline_;
   path_type path_;
+
+  runs_type runs_;
+  labels_type labels_;
 };
 
 } // namespace cte
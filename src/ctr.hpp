@@ -136,6 +136,18 @@ public:
       , id_{id} {
   }
 
+  inline contour(contour const& other, allocator_type const& allocator)
+      : sorted_{other.sorted_}
+      , edges_{other.edges_, allocator}
+      , base_{other.base_}
+      , width_{other.width_}
+      , area_{other.area_}
+      , perimeter_{other.perimeter_}
+      , id_{other.id_}
+      , enclosure_{other.enclosure_}
+      , color_{other.color_} {
+  }
+
   inline void add_point(pixel_type const* point, edge_side side) {
     ++area_;
 
@@ -54,9 +54,13 @@ namespace details {
     }
   }
 
+  // a frame can hold any number of regions, with narrow ids those past
+  // max_contours would be left out of the foreground
   template<typename Alloc>
-  using extractor_t =
-      cte::extractor<cpl::nat_cc, all::rebind_alloc_t<Alloc, ctr::edge>>;
+  using extractor_t = cte::extractor<cpl::nat_cc,
+                                     all::rebind_alloc_t<Alloc, ctr::edge>,
+                                     cte::labeling::runs,
+                                     cte::wide_id>;
 
 } // namespace details
 
@@ -72,12 +76,23 @@ public:
       std::vector<all::rebind_alloc_t<allocator_type, ctr::edge>>;
 
 public:
+  // background has to be set by reset before the first extraction
+  explicit extractor(mrl::dimensions_t dimensions,
+                     allocator_type const& allocator = allocator_type{})
+      : contours_{dimensions, allocator}
+      , mask_{dimensions} {
+  }
+
   extractor(sid::nat::dimg_t const& background,
             mrl::dimensions_t dimensions,
             allocator_type const& allocator = allocator_type{})
-      : background_{&background}
-      , contours_{dimensions, allocator}
-      , mask_{dimensions} {
+      : extractor{dimensions, allocator} {
+    reset(background);
+  }
+
+  // buffers are kept, so one extractor can serve frames of many fragments
+  inline void reset(sid::nat::dimg_t const& background) noexcept {
+    background_ = &background;
   }
 
   [[nodiscard]] contours_t<allocator_type>
@@ -115,7 +130,7 @@ private:
 
 private:
   details::extractor_t<allocator_type> contours_;
-  sid::nat::dimg_t const* background_;
+  sid::nat::dimg_t const* background_{nullptr};
   sid::mon::dimg_t mask_;
 };
 
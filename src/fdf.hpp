@@ -8,6 +8,9 @@
 
 #include <execution>
 #include <iterator>
+#include <numeric>
+#include <span>
+#include <thread>
 
 namespace fdf {
 
@@ -16,8 +19,84 @@ struct background {
   sid::nat::dimg_t image_;
 };
 
+using contours_t = fde::contours_t<std::allocator<cpl::nat_cc>>;
+
 namespace details {
 
+  inline constexpr std::size_t batch_size{64};
+
+  struct filtered {
+    sid::nat::dimg_t image_;
+    sid::nat::dimg_t median_;
+    contours_t foreground_;
+    sid::mon::dimg_t mask_;
+  };
+
+  // reuses the output image when the decompressor can write into it
+  template<typename Comp>
+  void decompress(Comp& comp,
+                  icd::compressed_t const& data,
+                  mrl::dimensions_t const& dim,
+                  sid::nat::dimg_t& output) {
+    if constexpr (icd::buffered_decompressor<std::decay_t<Comp>>) {
+      if (output.width() != dim.width_ || output.height() != dim.height_) {
+        output = sid::nat::dimg_t{dim};
+      }
+
+      comp(data, output);
+    }
+    else {
+      output = comp(data, dim);
+    }
+  }
+
+  using extractor_t = fde::extractor<std::allocator<char>>;
+
+  // one extractor per worker, kept for all batches of all fragments
+  [[nodiscard]] inline std::vector<extractor_t>
+      get_extractors(mrl::dimensions_t const& frame_dim) {
+    auto threads{std::max(std::thread::hardware_concurrency(), 1u)};
+
+    std::vector<extractor_t> result{};
+    result.reserve(threads);
+    for (std::size_t i{0}; i < threads; ++i) {
+      result.emplace_back(frame_dim);
+    }
+
+    return result;
+  }
+
+  // frames of the batch are split among workers, each with its own extractor
+  template<typename Comp>
+  void filter_batch(std::span<fgm::frame const> frames,
+                    background const& background,
+                    mrl::dimensions_t const& frame_dim,
+                    Comp& comp,
+                    std::vector<extractor_t>& extractors,
+                    std::vector<filtered>& output) {
+    std::vector<std::size_t> workers(
+        std::min(frames.size(), extractors.size()));
+    std::iota(workers.begin(), workers.end(), 0);
+
+    std::for_each(
+        std::execution::par, workers.begin(), workers.end(), [&](auto first) {
+          auto& extractor{extractors[first]};
+          extractor.reset(background.image_);
+
+          for (auto i{first}; i < frames.size(); i += workers.size()) {
+            auto& [no, pos, data, repeats]{frames[i]};
+            auto& [image, median, foreground, mask]{output[i]};
+
+            decompress(comp, data.image_, frame_dim, image);
+            decompress(comp, data.median_, frame_dim, median);
+
+            foreground =
+                extractor.extract(image, median, pos - background.zero_);
+            mask = fde::mask(foreground, image.dimensions());
+          }
+        });
+  }
+
   [[nodiscard]] inline std::vector<background>
       get_background(std::vector<fgm::fragment> const& fragments) {
     std::vector<background> results{fragments.size()};
@@ -35,8 +114,6 @@ namespace details {
 
 } // namespace details
 
-using contours_t = fde::contours_t<std::allocator<cpl::nat_cc>>;
-
 template<typename Comp, typename Callback>
 [[nodiscard]] std::vector<fgm::fragment> filter(
     std::vector<fgm::fragment> const& fragments,
@@ -47,25 +124,37 @@ template<typename Comp, typename Callback>
                                               std::allocator<cpl::nat_cc>>) {
   std::vector<fgm::fragment> results{};
 
+  std::vector<details::filtered> batch(details::batch_size);
+  auto extractors{details::get_extractors(frame_dim)};
+
   std::size_t i{0};
   for (auto& fragment : fragments) {
     auto& background{backgrounds[i]};
 
-    fde::extractor<std::allocator<char>> extractor{background.image_,
-                                                   frame_dim};
-
     auto& result{
         results.emplace_back(background.image_.dimensions(), background.zero_)};
 
-    for (auto& [no, pos, data] : fragment.frames()) {
-      auto image{comp(data.image_, frame_dim)};
-      auto median{comp(data.median_, frame_dim)};
-
-      auto foreground{extractor.extract(image, median, pos - result.zero())};
-      auto mask{fde::mask(foreground, image.dimensions())};
-      result.blit(pos, image, mask, no);
-
-      cb(result, i, image, no, median, pos, foreground, mask);
+    std::span<fgm::frame const> frames{fragment.frames()};
+    for (std::size_t first{0}; first < frames.size();
+         first += details::batch_size) {
+      auto part{frames.subspan(
+          first, std::min(details::batch_size, frames.size() - first))};
+      details::filter_batch(
+          part, background, frame_dim, comp, extractors, batch);
+
+      // blits and callbacks keep the order of frames
+      for (std::size_t j{0}; j < part.size(); ++j) {
+        auto& [no, pos, data, repeats]{part[j]};
+        auto& [image, median, foreground, mask]{batch[j]};
+
+        result.blit(pos, image, mask, no);
+        cb(result, i, image, no, median, pos, foreground, mask);
+
+        for (auto repeat : repeats) {
+          result.blit(pos, image, mask, repeat);
+          cb(result, i, image, repeat, median, pos, foreground, mask);
+        }
+      }
     }
 
     ++i;
@@ -4,8 +4,12 @@
 #pragma once
 
 #include "icd.hpp"
+#include "tcv.hpp"
 
 #include <algorithm>
+#include <bit>
+#include <intrin.h>
+#include <limits>
 
 namespace fgm {
 
@@ -13,10 +17,129 @@ inline constexpr std::uint8_t depth{16};
 
 using dot_type = std::array<std::uint16_t, depth>;
 
+inline constexpr std::uint32_t max_count{
+    std::numeric_limits<dot_type::value_type>::max()};
+
+static_assert(sizeof(dot_type) == sizeof(__m256i));
+
+// index of the first largest counter, same as std::max_element would pick
+[[nodiscard]] inline std::uint8_t argmax(dot_type const& dot) noexcept {
+  auto counters{
+      _mm256_loadu_si256(reinterpret_cast<__m256i const*>(dot.data()))};
+
+  auto ones{_mm_set1_epi16(-1)};
+  auto half{_mm_max_epu16(_mm256_castsi256_si128(counters),
+                          _mm256_extracti128_si256(counters, 1))};
+  auto top{_mm_xor_si128(_mm_minpos_epu16(_mm_xor_si128(half, ones)), ones)};
+
+  auto hits{_mm256_movemask_epi8(
+      _mm256_cmpeq_epi16(counters, _mm256_broadcastw_epi16(top)))};
+
+  return static_cast<std::uint8_t>(
+      std::countr_zero(static_cast<std::uint32_t>(hits)) >> 1);
+}
+
 [[nodiscard]] inline bool is_empty(dot_type const& dot) noexcept {
   return std::all_of(begin(dot), end(dot), [](auto v) { return v == 0; });
 }
 
+// dominant color and its count while a map pixel has seen only one color,
+// index of the full histogram once it has seen more
+class cell {
+public:
+  static inline constexpr std::uint32_t spilled_bit{1u << 31};
+  static inline constexpr std::uint32_t count_shift{4};
+  static inline constexpr std::uint32_t count_limit{
+      (spilled_bit >> count_shift) - 1};
+
+public:
+  [[nodiscard]] inline bool empty() const noexcept {
+    return value_ == 0;
+  }
+
+  [[nodiscard]] inline bool spilled() const noexcept {
+    return (value_ & spilled_bit) != 0;
+  }
+
+  [[nodiscard]] inline std::uint8_t color() const noexcept {
+    return static_cast<std::uint8_t>(value_ & (depth - 1));
+  }
+
+  [[nodiscard]] inline std::uint32_t count() const noexcept {
+    return value_ >> count_shift;
+  }
+
+  [[nodiscard]] inline std::uint32_t index() const noexcept {
+    return value_ & ~spilled_bit;
+  }
+
+  inline void set(std::uint8_t color, std::uint32_t count) noexcept {
+    value_ = (std::min(count, count_limit) << count_shift) | color;
+  }
+
+  inline void spill(std::uint32_t index) noexcept {
+    value_ = index | spilled_bit;
+  }
+
+private:
+  std::uint32_t value_{0};
+};
+
+// histogram counter grown by count, stops at max_count instead of wrapping
+inline void saturating_add(dot_type::value_type& counter,
+                           std::uint32_t count) noexcept {
+  counter = static_cast<dot_type::value_type>(
+      std::min<std::uint32_t>(counter + count, max_count));
+}
+
+// cells of a whole fragment in a dense matrix, histograms of spilled cells are
+// shared with the fragment that produced the map
+class cell_map {
+public:
+  using matrix_type = mrl::matrix<cell>;
+
+public:
+  inline cell_map(matrix_type&& cells,
+                  std::vector<dot_type> const& spill) noexcept
+      : cells_{std::move(cells)}
+      , spill_{&spill} {
+  }
+
+  [[nodiscard]] inline matrix_type const& cells() const noexcept {
+    return cells_;
+  }
+
+  // histogram of a spilled cell
+  [[nodiscard]] inline dot_type const& histogram(cell c) const noexcept {
+    return (*spill_)[c.index()];
+  }
+
+  // bit for each color the cell has counted
+  [[nodiscard]] std::uint16_t colors(cell c) const noexcept {
+    if (!c.spilled()) {
+      return c.empty() ? 0 : static_cast<std::uint16_t>(1u << c.color());
+    }
+
+    std::uint16_t result{0};
+    auto& dot{histogram(c)};
+    for (std::uint8_t i{0}; i < depth; ++i) {
+      if (dot[i] != 0) {
+        result |= static_cast<std::uint16_t>(1u << i);
+      }
+    }
+
+    return result;
+  }
+
+  [[nodiscard]] inline std::uint8_t dominant(cell c) const noexcept {
+    return c.spilled() ? argmax(histogram(c)) : c.color();
+  }
+
+private:
+  matrix_type cells_;
+  std::vector<dot_type> const* spill_;
+};
+
 using point_t = cdt::point<std::int32_t>;
 
 struct fragment_blend {
@@ -29,42 +152,50 @@ struct packed_data {
   icd::compressed_t median_;
 };
 
+// later frames identical to this one share its position and packed data
 struct frame {
   std::size_t number_;
   point_t position_;
 
   packed_data data_;
+  std::vector<std::size_t> repeats_;
 };
 
 class fragment {
 public:
   using matrix_type = mrl::matrix<dot_type>;
+  using canvas_type = tcv::canvas<cell>;
 
 public:
   inline fragment() noexcept
       : step_{1, 1}
-      , dots_{step_} {
+      , dimensions_{step_} {
   }
 
   inline explicit fragment(mrl::dimensions_t const& step) noexcept
       : step_{step}
-      , dots_{step} {
+      , dimensions_{step} {
   }
 
-  inline fragment(matrix_type dots,
+  inline fragment(matrix_type const& dots,
                   mrl::dimensions_t const& step,
                   point_t const& zero,
-                  std::vector<fgm::frame>&& frames) noexcept
+                  std::vector<fgm::frame>&& frames)
       : step_{step}
-      , dots_{std::move(dots)}
+      , dimensions_{dots.dimensions()}
       , zero_{zero}
       , frames_{std::move(frames)} {
+    blit_impl(zero_, dots, [this](auto dst, auto src, auto count) {
+      for (auto last{dst + count}; dst < last; ++dst, ++src) {
+        add(*dst, *src);
+      }
+    });
   }
 
   inline fragment(mrl::dimensions_t const& dimensions,
                   point_t const& zero) noexcept
       : step_{1, 1}
-      , dots_{dimensions}
+      , dimensions_{dimensions}
       , zero_{zero} {
   }
 
@@ -75,11 +206,12 @@ public:
             std::size_t frame_no) {
     ensure(pos, image.dimensions());
 
-    blit_impl(pos, image, [m = mask.data()](auto dst, auto src) mutable {
-      if (value(*(m++)) == 0) {
-        ++(*dst)[value(*src)];
-      }
-    });
+    blit_impl(pos,
+              image,
+              [this, first = image.data(), m = mask.data()](
+                  auto dst, auto src, auto count) {
+                accumulate(dst, src, m + (src - first), count);
+              });
 
     frames_.emplace_back(frame_no, pos);
   }
@@ -91,45 +223,96 @@ public:
             std::size_t frame_no) {
     ensure(pos, image.dimensions());
 
-    blit_impl(pos, image, [](auto dst, auto src) { ++(*dst)[value(*src)]; });
+    blit_impl(pos, image, [this](auto dst, auto src, auto count) {
+      accumulate(dst, src, nullptr, count);
+    });
 
     frames_.emplace_back(frame_no, pos, std::move(packed));
   }
 
-  void blit(point_t pos, fragment&& other) {
-    ensure(pos, other.dots_.dimensions());
+  // adds the image once more where the last frame was blitted
+  template<typename Alloc>
+  void repeat(sid::nat::aimg_t<Alloc> const& image, std::size_t frame_no) {
+    auto& last{frames_.back()};
 
-    blit_impl(pos, other.dots_, [](auto dst, auto src) {
-      for (std::uint8_t i{0}; i < depth; ++i) {
-        (*dst)[i] += (*src)[i];
-      }
+    blit_impl(last.position_, image, [this](auto dst, auto src, auto count) {
+      accumulate(dst, src, nullptr, count);
     });
 
+    last.repeats_.push_back(frame_no);
+  }
+
+  void blit(point_t pos, fragment&& other) {
+    ensure(pos, other.dimensions_);
+
+    auto shift{pos - other.zero_};
+    other.canvas_.read(
+        other.zero_ + other.origin_,
+        other.dimensions_,
+        [this, &other, delta = shift - other.origin_](
+            point_t at, cell const* src, std::size_t count) {
+          if (src == nullptr) {
+            return;
+          }
+
+          canvas_.write(
+              at + delta + origin_,
+              {count, 1},
+              [this, &other, src](point_t, cell* dst, std::size_t n) mutable {
+                for (auto last{dst + n}; dst < last; ++dst, ++src) {
+                  if (src->spilled()) {
+                    add(*dst, other.spill_[src->index()]);
+                  }
+                  else if (!src->empty()) {
+                    add(*dst, src->color(), src->count());
+                  }
+                }
+              });
+        });
+
     frames_.reserve(frames_.size() + other.frames_.size());
     for (auto& f : other.frames_) {
-      frames_.emplace_back(
-          f.number_, f.position_ - other.zero_ + pos, std::move(f.data_));
+      frames_.emplace_back(f.number_,
+                           f.position_ + shift,
+                           std::move(f.data_),
+                           std::move(f.repeats_));
     }
   }
 
   [[nodiscard]] fragment_blend blend() const {
     using namespace cpl;
 
-    sid::nat::dimg_t image{dots_.dimensions()};
-    sid::mon::dimg_t mask{dots_.dimensions()};
+    sid::nat::dimg_t image{dimensions_};
+    sid::mon::dimg_t mask{dimensions_};
 
     auto img_out{image.data()};
     auto mask_out{mask.data()};
 
-    for (auto first{dots_.data()}, last{dots_.end()}; first < last;
-         ++first, ++img_out, ++mask_out) {
-      auto dot{&(*first)[0]};
-      auto selected{std::max_element(dot, dot + depth)};
-      if (*selected != 0) {
-        *img_out = {static_cast<cpl::nat_cc::value_type>(selected - dot)};
-        *mask_out = *selected != 0 ? 1_bv : 0_bv;
+    read([this, &img_out, &mask_out](cell const* first, std::size_t count) {
+      if (first == nullptr) {
+        img_out += count;
+        mask_out += count;
+        return;
       }
-    }
+
+      for (auto last{first + count}; first < last;
+           ++first, ++img_out, ++mask_out) {
+        if (!first->spilled()) {
+          if (!first->empty()) {
+            *img_out = {first->color()};
+            *mask_out = 1_bv;
+          }
+
+          continue;
+        }
+
+        auto& dot{spill_[first->index()]};
+        if (auto selected{argmax(dot)}; dot[selected] != 0) {
+          *img_out = {selected};
+          *mask_out = 1_bv;
+        }
+      }
+    });
 
     return {std::move(image), std::move(mask)};
   }
@@ -139,25 +322,95 @@ public:
       frame.position_ -= zero_;
     }
 
+    origin_ += zero_;
     zero_ = {0, 0};
   }
 
   [[nodiscard]] mrl::region_t margins() const noexcept {
-    mrl::region_t region{
-        dots_.width(), dots_.height(), dots_.width(), dots_.height()};
+    auto width{static_cast<std::int32_t>(dimensions_.width_)};
+    auto height{static_cast<std::int32_t>(dimensions_.height_)};
+
+    point_t low{width, height}, high{-1, -1};
+
+    std::int32_t x{0}, y{0};
+    read([&](cell const* first, std::size_t count) {
+      if (first != nullptr) {
+        for (std::size_t i{0}; i < count; ++i) {
+          if (!empty(first[i])) {
+            auto at{x + static_cast<std::int32_t>(i)};
+
+            low = {std::min(low.x_, at), std::min(low.y_, y)};
+            high = {std::max(high.x_, at), std::max(high.y_, y)};
+          }
+        }
+      }
 
-    hor_margins(region);
-    ver_margins(region);
+      if (x += static_cast<std::int32_t>(count); x == width) {
+        x = 0;
+        ++y;
+      }
+    });
 
-    return region;
+    if (high.x_ < 0) {
+      return {dimensions_.width_,
+              dimensions_.height_,
+              dimensions_.width_,
+              dimensions_.height_};
+    }
+
+    return {static_cast<std::size_t>(low.x_),
+            static_cast<std::size_t>(low.y_),
+            static_cast<std::size_t>(width - 1 - high.x_),
+            static_cast<std::size_t>(height - 1 - high.y_)};
   }
 
-  [[nodiscard]] inline matrix_type const& dots() const noexcept {
-    return dots_;
+  // spilled histograms are not copied, the map cannot outlive the fragment
+  [[nodiscard]] cell_map cells() const {
+    cell_map::matrix_type result{dimensions_};
+
+    auto out{result.data()};
+    read([&out](cell const* first, std::size_t count) {
+      if (first != nullptr) {
+        std::copy(first, first + count, out);
+      }
+
+      out += count;
+    });
+
+    return {std::move(result), spill_};
+  }
+
+  // fn(dots, width) for each row, expanded one row at a time
+  template<typename Fn>
+  void rows(Fn&& fn) const {
+    std::vector<dot_type> row(dimensions_.width_);
+
+    std::size_t x{0};
+    read([this, &fn, &row, &x](cell const* first, std::size_t count) {
+      if (first != nullptr) {
+        std::transform(first, first + count, row.begin() + x, [this](cell c) {
+          return expand(c);
+        });
+      }
+      else {
+        std::fill_n(row.begin() + x, count, dot_type{});
+      }
+
+      if (x += count; x == row.size()) {
+        fn(std::as_const(row).data(), row.size());
+        x = 0;
+      }
+    });
+  }
+
+  // canvas tiles plus histograms of pixels that have seen more than one color
+  [[nodiscard]] inline std::size_t memory() const noexcept {
+    return canvas_.allocated() * sizeof(canvas_type::tile_type) +
+           spill_.size() * sizeof(dot_type);
   }
 
   [[nodiscard]] inline mrl::dimensions_t dimensions() const noexcept {
-    return dots_.dimensions();
+    return dimensions_;
   }
 
   [[nodiscard]] inline mrl::dimensions_t step() const noexcept {
@@ -175,16 +428,146 @@ public:
 private:
   template<typename Ty, typename Alloc, typename Fn>
   void blit_impl(point_t pos, mrl::matrix<Ty, Alloc> const& source, Fn fn) {
-    auto adj_x{pos.x_ - zero_.x_}, adj_y{pos.y_ - zero_.y_};
-    auto stride{dots_.width() - source.width()};
-
-    auto dst{dots_.data() + adj_x + adj_y * dots_.width()};
-    for (auto first{source.data()}, last{source.end()}; first < last;
-         dst += stride) {
-      for (auto end{first + source.width()}; first < end; ++first, ++dst) {
-        fn(dst, first);
+    auto width{static_cast<std::int32_t>(source.width())};
+    auto data{source.data()};
+
+    canvas_.write(
+        pos + origin_,
+        source.dimensions(),
+        [&fn, data, width, base = pos + origin_](
+            point_t at, cell* dst, std::size_t count) {
+          fn(dst, data + (at.y_ - base.y_) * width + (at.x_ - base.x_), count);
+        });
+  }
+
+  // adds one count of each source color to a row of cells, skipping pixels
+  // that have mask set; eight cells at a time while they stay compact
+  void accumulate(cell* dst,
+                  cpl::nat_cc const* src,
+                  cpl::mon_bv const* mask,
+                  std::size_t count) {
+    static_assert(sizeof(cell) == sizeof(std::uint32_t));
+
+    constexpr std::size_t lanes{sizeof(__m256i) / sizeof(cell)};
+
+    auto zero{_mm256_setzero_si256()};
+    auto unit{_mm256_set1_epi32(1 << cell::count_shift)};
+    auto kind{_mm256_set1_epi32(cell::spilled_bit | (depth - 1))};
+
+    auto last{dst + count};
+    for (auto bulk{dst + count - count % lanes}; dst < bulk;
+         dst += lanes, src += lanes) {
+      auto cells{_mm256_loadu_si256(reinterpret_cast<__m256i const*>(dst))};
+      auto colors{_mm256_cvtepu8_epi32(
+          _mm_loadl_epi64(reinterpret_cast<__m128i const*>(src)))};
+
+      auto empty{_mm256_cmpeq_epi32(cells, zero)};
+      auto same{_mm256_cmpeq_epi32(_mm256_and_si256(cells, kind), colors)};
+
+      auto updated{_mm256_blendv_epi8(_mm256_add_epi32(cells, unit),
+                                      _mm256_or_si256(colors, unit),
+                                      empty)};
+
+      // count limit reached, spilled or different color
+      auto fast{_mm256_andnot_si256(_mm256_srai_epi32(updated, 31),
+                                    _mm256_or_si256(empty, same))};
+
+      auto keep{_mm256_set1_epi32(-1)};
+      if (mask != nullptr) {
+        keep = _mm256_cmpeq_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64(
+                                      reinterpret_cast<__m128i const*>(mask))),
+                                  zero);
+        mask += lanes;
+      }
+
+      _mm256_storeu_si256(
+          reinterpret_cast<__m256i*>(dst),
+          _mm256_blendv_epi8(cells, updated, _mm256_and_si256(keep, fast)));
+
+      auto slow{static_cast<std::uint32_t>(_mm256_movemask_ps(
+          _mm256_castsi256_ps(_mm256_andnot_si256(fast, keep))))};
+      for (; slow != 0; slow &= slow - 1) {
+        auto i{std::countr_zero(slow)};
+        add(dst[i], value(src[i]), 1);
       }
     }
+
+    for (; dst < last; ++dst, ++src) {
+      if (mask == nullptr || value(*(mask++)) == 0) {
+        add(*dst, value(*src), 1);
+      }
+    }
+  }
+
+  // fn(data, count) over the rows of the fragment, in row-major order
+  template<typename Fn>
+  inline void read(Fn&& fn) const {
+    canvas_.read(
+        zero_ + origin_,
+        dimensions_,
+        [&fn](point_t /*unused*/, cell const* data, std::size_t count) {
+          fn(data, count);
+        });
+  }
+
+  void add(cell& dst, std::uint8_t color, std::uint32_t count) {
+    if (dst.spilled()) {
+      saturating_add(spill_[dst.index()][color], count);
+    }
+    else if (dst.empty() || dst.color() == color) {
+      dst.set(color, dst.count() + count);
+    }
+    else {
+      saturating_add(promote(dst)[color], count);
+    }
+  }
+
+  void add(cell& dst, dot_type const& src) {
+    std::size_t used{0};
+    std::uint8_t color{0};
+    for (std::uint8_t i{0}; i < depth; ++i) {
+      if (src[i] != 0) {
+        ++used;
+        color = i;
+      }
+    }
+
+    if (used == 1) {
+      add(dst, color, src[color]);
+    }
+    else if (used != 0) {
+      auto& dot{promote(dst)};
+      for (std::uint8_t i{0}; i < depth; ++i) {
+        saturating_add(dot[i], src[i]);
+      }
+    }
+  }
+
+  dot_type& promote(cell& dst) {
+    if (!dst.spilled()) {
+      spill_.push_back(expand(dst));
+      dst.spill(static_cast<std::uint32_t>(spill_.size() - 1));
+    }
+
+    return spill_[dst.index()];
+  }
+
+  [[nodiscard]] dot_type expand(cell c) const noexcept {
+    if (c.spilled()) {
+      return spill_[c.index()];
+    }
+
+    dot_type dot{};
+    if (!c.empty()) {
+      dot[c.color()] = static_cast<std::uint16_t>(
+          std::min<std::uint32_t>(c.count(), max_count));
+    }
+
+    return dot;
+  }
+
+  [[nodiscard]] inline bool empty(cell c) const noexcept {
+    return c.spilled() ? is_empty(spill_[c.index()]) : c.empty();
   }
 
   void ensure(point_t pos, mrl::dimensions_t const& dim) {
@@ -194,7 +577,10 @@ private:
     auto extend_v{extend<1>(region, pos, dim)};
 
     if (extend_h || extend_v) {
-      dots_ = dots_.extend(region);
+      auto margins{region.margins()};
+
+      dimensions_.width_ += margins.x_;
+      dimensions_.height_ += margins.y_;
     }
   }
 
@@ -212,7 +598,7 @@ private:
 
     auto required{get<Idx>(pos) + static_cast<std::int32_t>(get<Idx>(dim))};
     if (required > 0) {
-      if (auto limit{get<Idx>(zero_) + get<Idx>(dots_.dimensions())};
+      if (auto limit{get<Idx>(zero_) + get<Idx>(dimensions_)};
           static_cast<std::size_t>(required) > limit) {
         get<Idx + 2>(region) = get_step<Idx>(required - limit);
 
@@ -232,73 +618,15 @@ private:
     return (change - rest) + (rest != 0 ? step : 0);
   }
 
-  void hor_margins(mrl::region_t& region) const noexcept {
-    auto width{dots_.width()};
-
-    for (auto row{dots_.data()}, rend{dots_.end()}; row < rend; row += width) {
-      std::size_t x{};
-      for (auto col{row}, cend{row + width}; col < cend; ++col, ++x) {
-        if (!is_empty(*col)) {
-          if (x < region.left_) {
-            region.left_ = x;
-          }
-
-          break;
-        }
-      }
-
-      x = 0;
-      for (auto col{row + width - 1}; col >= row; --col, ++x) {
-        if (!is_empty(*col)) {
-          if (x < region.right_) {
-            region.right_ = x;
-          }
-
-          break;
-        }
-      }
-    }
-  }
-
-  void ver_margins(mrl::region_t& region) const noexcept {
-    auto width{dots_.width()};
-    auto height{dots_.width()};
-    auto size{dots_.size()};
-
-    auto end{dots_.end()};
-
-    for (auto col{dots_.data()}, cend{dots_.data() + width}, rend{dots_.end()};
-         col < cend;
-         ++col) {
-      std::size_t y{};
-      for (auto row{col}; row < end; row += width, ++y) {
-        if (!is_empty(*row)) {
-          if (y < region.top_) {
-            region.top_ = y;
-          }
-
-          break;
-        }
-      }
-
-      y = 0;
-      for (auto row{col + size - width}; row >= col; row -= width, ++y) {
-        if (!is_empty(*row)) {
-          if (y < region.bottom_) {
-            region.bottom_ = y;
-          }
-
-          break;
-        }
-      }
-    }
-  }
-
 private:
   mrl::dimensions_t step_;
-  matrix_type dots_;
+  mrl::dimensions_t dimensions_;
 
   point_t zero_;
+  point_t origin_{};
+
+  canvas_type canvas_;
+  std::vector<dot_type> spill_;
 
   std::vector<frame> frames_;
 };
@@ -3,102 +3,314 @@
 
 #pragma once
 
+#include "all.hpp"
 #include "fgm.hpp"
 #include "kpe.hpp"
 #include "kpm.hpp"
 
 #include <execution>
+#include <memory>
+#include <optional>
+#include <queue>
 #include <stack>
+#include <unordered_map>
 
 namespace fgs {
 
 namespace details {
 
-  using grid_t = kpr::grid<1, 1, std::allocator<char>>;
+  using grid_t = kpr::grid<1, 1, all::frame_allocator<char>>;
+  using extractor_t = kpe::extractor<grid_t, 0>;
 
-  struct delta;
-  struct snippet;
+  inline constexpr std::size_t match_arena_size{1 << 16};
 
-  using edges_t = std::list<delta>;
-  using snippet_iterator_t = std::list<snippet>::iterator;
+  // pairs of fragments that share fewer codes are not matched, codes found in
+  // too many fragments are not counted
+  inline constexpr std::size_t shared_codes{16};
+  inline constexpr std::size_t common_codes{32};
 
-  struct snippet {
-    [[nodiscard]] void bind(snippet_iterator_t self,
-                            snippet_iterator_t other,
-                            kpm::vote const& vote);
-
-    void unbind();
+  using snippet_id_t = std::size_t;
 
-    [[nodiscard]] edges_t::iterator
-        add(bool primary, kpm::vote const& vote, snippet_iterator_t other);
+  struct snippet {
+    std::unique_ptr<all::memory_pool> arena_;
 
     fgm::fragment fragment_;
     sid::mon::dimg_t mask_;
 
     grid_t grid_;
-
-    edges_t edges_;
   };
 
-  struct delta {
-    delta(bool primary, kpm::vote const& vote, snippet_iterator_t other)
-        : primary_{primary}
-        , vote_{primary ? vote : vote.reverse()}
-        , other_{other} {
+  // splice candidate; rank and sequence reproduce the order in which edges
+  // were bound, so ties are broken deterministically
+  struct edge {
+    kpm::vote vote_;
+
+    snippet_id_t left_;
+    snippet_id_t right_;
+
+    std::int64_t rank_;
+    std::size_t sequence_;
+
+    [[nodiscard]] inline friend bool operator<(edge const& lhs,
+                                               edge const& rhs) noexcept {
+      if (lhs.vote_.count_ != rhs.vote_.count_) {
+        return lhs.vote_.count_ < rhs.vote_.count_;
+      }
+
+      if (lhs.rank_ != rhs.rank_) {
+        return lhs.rank_ > rhs.rank_;
+      }
+
+      return lhs.sequence_ > rhs.sequence_;
     }
+  };
+
+  [[nodiscard]] snippet extract_single(fgm::fragment&& fragment) {
+    auto [blend, mask]{fragment.blend()};
+    auto dimensions{blend.dimensions()};
 
-    bool primary_;
+    auto arena{std::make_unique<all::memory_pool>(dimensions.area())};
 
-    kpm::vote vote_;
+    all::memory_pool scratch{dimensions.area()};
+    all::frame_allocator<cpl::nat_cc> temp{scratch};
 
-    snippet_iterator_t other_;
-    edges_t::iterator backlink_;
+    extractor_t::matrix_type median{dimensions, temp};
+
+    extractor_t extractor{dimensions};
+    auto grid{extractor.extract(blend, median, grid_t::allocator_type{*arena})};
+
+    return {std::move(arena),
+            std::move(fragment),
+            std::move(mask),
+            std::move(grid)};
+  }
+
+  // signed counterpart of mrl::region_t, inputs can extend past the splice
+  struct rect_t {
+    std::int32_t left_;
+    std::int32_t top_;
+    std::int32_t right_;
+    std::int32_t bottom_;
+  };
+
+  using strips_t = std::vector<mrl::region_t>;
+
+  // the extractor leaves out kernel_half pixels at the edges of the image and
+  // kernel_size - 1 rows at its bottom
+  inline constexpr std::int32_t edge_skip{kpe::kernel_half};
+  inline constexpr std::int32_t bottom_skip{kpe::kernel_size - 1};
+
+  struct keypoint {
+    kpr::code code_;
+    mrl::point_t point_;
+  };
+
+  // keypoints of one side of a splice, placed in the spliced fragment
+  struct splice_input {
+    grid_t::region_type const& region_;
+    cdt::offset_t shift_;
+    mrl::dimensions_t dimensions_;
+
+    [[nodiscard]] inline rect_t area() const noexcept {
+      return {shift_.x_,
+              shift_.y_,
+              shift_.x_ + static_cast<std::int32_t>(dimensions_.width_),
+              shift_.y_ + static_cast<std::int32_t>(dimensions_.height_)};
+    }
   };
 
-  inline void snippet::bind(snippet_iterator_t self,
-                            snippet_iterator_t other,
-                            kpm::vote const& vote) {
-    auto edge1{add(true, vote, other)};
-    auto edge2{other->add(false, vote, self)};
+  [[nodiscard]] inline rect_t inflate(rect_t const& rect,
+                                      std::int32_t size) noexcept {
+    return {rect.left_ - size,
+            rect.top_ - size,
+            rect.right_ + size,
+            rect.bottom_ + size};
+  }
+
+  inline void add_strip(strips_t& strips,
+                        rect_t const& rect,
+                        mrl::dimensions_t const& dim) {
+    auto left{std::max(rect.left_, 0)}, top{std::max(rect.top_, 0)};
+    auto right{std::min(rect.right_, static_cast<std::int32_t>(dim.width_))};
+    auto bottom{
+        std::min(rect.bottom_, static_cast<std::int32_t>(dim.height_))};
+
+    if (left < right && top < bottom) {
+      strips.push_back({static_cast<std::size_t>(left),
+                        static_cast<std::size_t>(top),
+                        static_cast<std::size_t>(right),
+                        static_cast<std::size_t>(bottom)});
+    }
+  }
+
+  // pixels whose neighbourhood may differ from the one they had in their own
+  // fragment: the overlap and bands along the edges of both inputs
+  [[nodiscard]] strips_t changed_strips(splice_input const& left,
+                                        splice_input const& right,
+                                        mrl::dimensions_t const& dim) {
+    strips_t strips{};
+
+    auto la{left.area()}, ra{right.area()};
+    rect_t common{std::max(la.left_, ra.left_),
+                  std::max(la.top_, ra.top_),
+                  std::min(la.right_, ra.right_),
+                  std::min(la.bottom_, ra.bottom_)};
+
+    if (common.left_ < common.right_ && common.top_ < common.bottom_) {
+      add_strip(strips, inflate(common, edge_skip), dim);
+    }
+
+    for (auto& area : {la, ra}) {
+      auto outer{inflate(area, edge_skip)};
+      rect_t inner{area.left_ + edge_skip,
+                   area.top_ + edge_skip,
+                   area.right_ - edge_skip,
+                   area.bottom_ - bottom_skip};
+
+      if (inner.left_ >= inner.right_ || inner.top_ >= inner.bottom_) {
+        add_strip(strips, outer, dim);
+        continue;
+      }
+
+      add_strip(
+          strips, {outer.left_, outer.top_, outer.right_, inner.top_}, dim);
+      add_strip(strips,
+                {outer.left_, inner.bottom_, outer.right_, outer.bottom_},
+                dim);
+      add_strip(
+          strips, {outer.left_, inner.top_, inner.left_, inner.bottom_}, dim);
+      add_strip(
+          strips, {inner.right_, inner.top_, outer.right_, inner.bottom_}, dim);
+    }
 
-    edge1->backlink_ = edge2;
-    edge2->backlink_ = edge1;
+    return strips;
   }
 
-  inline void snippet::unbind() {
-    for (auto& edge : edges_) {
-      edge.other_->edges_.erase(edge.backlink_);
+  void collect_keypoints(splice_input const& input,
+                         strips_t const& strips,
+                         std::vector<keypoint>& output) {
+    auto& region{input.region_};
+    auto& [dx, dy]{input.shift_};
+
+    for (auto& group : region.groups()) {
+      for (auto point : region.points(group)) {
+        point.x_ += static_cast<mrl::size_type>(dx);
+        point.y_ += static_cast<mrl::size_type>(dy);
+
+        if (std::none_of(strips.begin(), strips.end(), [&point](auto& s) {
+              return s.contains(point);
+            })) {
+          output.push_back({group.key_, point});
+        }
+      }
     }
   }
 
-  inline edges_t::iterator snippet::add(bool primary,
-                                        kpm::vote const& vote,
-                                        snippet_iterator_t other) {
-    return edges_.emplace(edges_.end(), primary, vote, other);
+  template<typename Image>
+  void extract_strip(Image const& image,
+                     mrl::region_t const& strip,
+                     std::vector<keypoint>& output) {
+    constexpr mrl::size_type edge{edge_skip}, bottom{bottom_skip};
+
+    auto& dim{image.dimensions()};
+    mrl::region_t area{strip.left_ - std::min(strip.left_, edge),
+                       strip.top_ - std::min(strip.top_, edge),
+                       std::min(strip.right_ + edge, dim.width_),
+                       std::min(strip.bottom_ + bottom, dim.height_)};
+
+    if (area.width() < kpe::kernel_size || area.height() < kpe::kernel_size) {
+      return;
+    }
+
+    all::memory_pool scratch{area.area() << 2};
+    all::frame_allocator<cpl::nat_cc> temp{scratch};
+
+    auto crop{image.crop({area.left_,
+                          area.top_,
+                          dim.width_ - area.right_,
+                          dim.height_ - area.bottom_},
+                         temp)};
+    extractor_t::matrix_type median{crop.dimensions(), temp};
+
+    extractor_t extractor{crop.dimensions()};
+    auto grid{extractor.extract(crop, median, grid_t::allocator_type{scratch})};
+
+    auto& region{grid[0]};
+    for (auto& group : region.groups()) {
+      for (auto point : region.points(group)) {
+        point += area.left_top();
+
+        if (strip.contains(point)) {
+          output.push_back({group.key_, point});
+        }
+      }
+    }
   }
 
-  [[nodiscard]] snippet extract_single(fgm::fragment&& fragment) {
-    auto [image, mask]{fragment.blend()};
+  // keypoints of the inputs are moved to the spliced fragment and only the
+  // strips where the blended image could have changed are extracted again
+  [[nodiscard]] snippet extract_spliced(fgm::fragment&& fragment,
+                                        splice_input const& left,
+                                        splice_input const& right) {
+    auto [blend, mask]{fragment.blend()};
+    auto dimensions{blend.dimensions()};
+
+    auto strips{changed_strips(left, right, dimensions)};
+
+    std::vector<keypoint> keypoints{};
+    collect_keypoints(left, strips, keypoints);
+    collect_keypoints(right, strips, keypoints);
+
+    for (auto& strip : strips) {
+      extract_strip(blend, strip, keypoints);
+    }
+
+    // order in which the extractor visits pixels, column by column
+    std::sort(
+        keypoints.begin(), keypoints.end(), [](auto& lhs, auto& rhs) {
+          return std::tie(lhs.point_.x_, lhs.point_.y_) <
+                 std::tie(rhs.point_.x_, rhs.point_.y_);
+        });
+
+    keypoints.erase(std::unique(keypoints.begin(),
+                                keypoints.end(),
+                                [](auto& lhs, auto& rhs) {
+                                  return lhs.point_ == rhs.point_;
+                                }),
+                    keypoints.end());
 
-    sid::nat::dimg_t median{image.dimensions(), image.get_allocator()};
+    auto arena{std::make_unique<all::memory_pool>(dimensions.area())};
 
-    kpe::extractor<grid_t, 0> extractor{image.dimensions()};
-    return {std::move(fragment),
+    grid_t grid{grid_t::allocator_type{*arena}};
+    for (auto& [code, point] : keypoints) {
+      grid.add(code, point, std::index_sequence<0>{});
+    }
+
+    grid.seal();
+
+    return {std::move(arena),
+            std::move(fragment),
             std::move(mask),
-            extractor.extract(image, median, image.get_allocator())};
+            std::move(grid)};
   }
 
   template<typename Iter>
   [[nodiscard]] auto extract_all(Iter first, Iter last) {
-    std::list<details::snippet> snippets{
-        static_cast<std::size_t>(std::distance(first, last)),
-        details::snippet{}};
+    std::vector<std::optional<snippet>> extracted(
+        static_cast<std::size_t>(std::distance(first, last)));
 
     std::transform(
-        std::execution::par, first, last, snippets.begin(), [](auto& fragment) {
-          return extract_single(std::move(fragment));
+        std::execution::par, first, last, extracted.begin(), [](auto& fragment) {
+          return std::optional{extract_single(std::move(fragment))};
         });
 
+    std::vector<snippet> snippets{};
+    snippets.reserve(extracted.size());
+
+    for (auto& item : extracted) {
+      snippets.push_back(std::move(*item));
+    }
+
     return snippets;
   }
 
@@ -116,100 +328,236 @@ namespace details {
     [[no_unique_address]] allocator_type allocator_;
   };
 
-  template<typename It>
-  void match_partial(It head, It first, It last) {
-    constexpr kpm::cell_size_t cell_size{15, 15};
-
-    for (; first != last; ++first) {
-      if (auto vote{kpm::match(head->grid_[0],
-                               head->mask_,
-                               first->grid_[0],
-                               first->mask_,
-                               cell_size)};
-          vote) {
-        head->bind(head, first, *vote);
+  class code_index {
+  public:
+    using shares_t = std::unordered_map<snippet_id_t, std::size_t>;
+
+  public:
+    void add(snippet_id_t id, snippet const& item) {
+      for (auto& group : item.grid_[0].groups()) {
+        postings_[group.key_].push_back(id);
       }
     }
-  }
 
-  template<typename It>
-  void match_all(It first, It last) {
-    for (auto rest{next(first)}; rest != last; ++first, ++rest) {
-      match_partial(first, rest, last);
+    void remove(snippet_id_t id, snippet const& item) {
+      for (auto& group : item.grid_[0].groups()) {
+        auto it{postings_.find(group.key_)};
+        std::erase(it->second, id);
+
+        if (it->second.empty()) {
+          postings_.erase(it);
+        }
+      }
     }
-  }
 
-  [[nodiscard]] auto select_match(std::list<snippet>& snippets) {
-    using item_t = std::tuple<snippet_iterator_t, delta*>;
-    using result_t = std::optional<item_t>;
+    [[nodiscard]] shares_t shares(snippet const& item) const {
+      shares_t result{};
+      for (auto& group : item.grid_[0].groups()) {
+        if (auto it{postings_.find(group.key_)};
+            it != postings_.end() && it->second.size() <= common_codes) {
+          for (auto other : it->second) {
+            ++result[other];
+          }
+        }
+      }
+
+      return result;
+    }
+
+  private:
+    std::unordered_map<kpr::code, std::vector<snippet_id_t>, kpr::code_hash>
+        postings_;
+  };
+
+  // snippets keep their ids for the whole splice; spliced ones leave empty
+  // slots behind and edges that point to them are dropped when popped
+  class graph {
+  public:
+    using pairs_t = std::vector<std::pair<snippet_id_t, snippet_id_t>>;
+
+  public:
+    explicit graph(std::vector<snippet>&& snippets) {
+      slots_.reserve(snippets.size());
+      ranks_.reserve(snippets.size());
 
-    std::vector<item_t> matches;
-    for (auto it{snippets.begin()}; it != snippets.end(); ++it) {
-      for (auto& edge : it->edges_) {
-        if (edge.primary_) {
-          matches.emplace_back(it, &edge);
+      for (auto& item : snippets) {
+        insert(std::move(item), static_cast<std::int64_t>(ranks_.size()));
+      }
+    }
+
+    void match_all() {
+      pairs_t pairs{};
+
+      auto order{ordered()};
+      for (auto it{order.begin()}; it != order.end(); ++it) {
+        collect_pairs(*it, it + 1, order.end(), pairs);
+      }
+
+      match_pairs(pairs);
+    }
+
+    [[nodiscard]] bool splice_next() {
+      while (!edges_.empty()) {
+        auto top{edges_.top()};
+        edges_.pop();
+
+        if (slots_[top.left_] && slots_[top.right_]) {
+          splice_single(top);
+          return true;
         }
       }
+
+      return false;
     }
 
-    if (!matches.empty()) {
-      return result_t{*max_element(
-          matches.begin(), matches.end(), [](auto& lhs, auto& rhs) {
-            return get<1>(lhs)->vote_.count_ < get<1>(rhs)->vote_.count_;
-          })};
+    [[nodiscard]] std::vector<fgm::fragment> release() {
+      std::vector<fgm::fragment> result{};
+      for (auto id : ordered()) {
+        result.push_back(std::move(slots_[id]->fragment_));
+      }
+
+      return result;
     }
 
-    return result_t{};
-  }
+  private:
+    snippet_id_t insert(snippet&& item, std::int64_t rank) {
+      auto id{slots_.size()};
+
+      index_.add(id, item);
+      slots_.emplace_back(std::move(item));
+      ranks_.push_back(rank);
+
+      return id;
+    }
 
-  void splice_single(std::list<snippet>& snippets,
-                     snippet_iterator_t left,
-                     delta* edge) {
-    auto right{edge->other_};
+    void remove(snippet_id_t id) {
+      index_.remove(id, *slots_[id]);
+      slots_[id].reset();
+    }
 
-    auto& dst{left->fragment_};
-    dst.blit(dst.zero() + edge->vote_.offset_, std::move(right->fragment_));
-    dst.normalize();
+    // live snippets, spliced ones first, newest to oldest
+    [[nodiscard]] std::vector<snippet_id_t> ordered() const {
+      std::vector<snippet_id_t> result{};
+      for (snippet_id_t id{0}; id < slots_.size(); ++id) {
+        if (slots_[id]) {
+          result.push_back(id);
+        }
+      }
 
-    snippets.emplace_front(extract_single(std::move(dst)));
+      std::sort(result.begin(), result.end(), [this](auto lhs, auto rhs) {
+        return ranks_[lhs] < ranks_[rhs];
+      });
 
-    right->unbind();
-    left->unbind();
+      return result;
+    }
 
-    snippets.erase(right);
-    snippets.erase(left);
+    template<typename It>
+    void collect_pairs(snippet_id_t head,
+                       It first,
+                       It last,
+                       pairs_t& pairs) const {
+      auto shares{index_.shares(*slots_[head])};
+      for (; first != last; ++first) {
+        if (auto it{shares.find(*first)};
+            it != shares.end() && it->second >= shared_codes) {
+          pairs.emplace_back(head, *first);
+        }
+      }
+    }
 
-    match_partial(snippets.begin(), next(snippets.begin()), snippets.end());
-  }
+    // pairs are matched in parallel, but bound in the order they were
+    // collected
+    void match_pairs(pairs_t const& pairs) {
+      constexpr kpm::cell_size_t cell_size{15, 15};
+
+      std::vector<std::optional<kpm::vote>> votes(pairs.size());
+      std::transform(std::execution::par,
+                     pairs.begin(),
+                     pairs.end(),
+                     votes.begin(),
+                     [this, &cell_size](auto& pair) {
+                       all::arena_scope arena{match_arena_size};
+
+                       auto& left{*slots_[pair.first]};
+                       auto& right{*slots_[pair.second]};
+                       return kpm::match(left.grid_[0],
+                                         left.mask_,
+                                         right.grid_[0],
+                                         right.mask_,
+                                         cell_size);
+                     });
+
+      for (std::size_t i{0}; i < pairs.size(); ++i) {
+        if (auto& [left, right]{pairs[i]}; votes[i]) {
+          edges_.push({*votes[i], left, right, ranks_[left], sequence_++});
+        }
+      }
+    }
 
-} // namespace details
+    void splice_single(edge const& selected) {
+      auto& left{*slots_[selected.left_]};
+      auto& right{*slots_[selected.right_]};
 
-template<typename Iter>
-[[nodiscard]] std::vector<fgm::fragment> splice(Iter first, Iter last) {
-  using namespace details;
+      auto& dst{left.fragment_};
+
+      auto zero{dst.zero()}, pos{zero + selected.vote_.offset_};
+      auto left_dim{dst.dimensions()}, right_dim{right.fragment_.dimensions()};
+
+      dst.blit(pos, std::move(right.fragment_));
+
+      auto base{dst.zero()};
+      dst.normalize();
 
-  auto snippets{extract_all(first, last)};
-  match_all(snippets.begin(), snippets.end());
+      auto spliced{extract_spliced(std::move(dst),
+                                   {left.grid_[0], zero - base, left_dim},
+                                   {right.grid_[0], pos - base, right_dim})};
 
-  while (true) {
-    auto match{select_match(snippets)};
-    if (!match) {
-      break;
+      remove(selected.right_);
+      remove(selected.left_);
+
+      auto head{insert(std::move(spliced), --front_)};
+
+      pairs_t pairs{};
+      auto order{ordered()};
+      collect_pairs(head, order.begin() + 1, order.end(), pairs);
+
+      match_pairs(pairs);
     }
 
-    auto& [left, edge]{*match};
-    splice_single(snippets, left, edge);
-  }
+  private:
+    std::vector<std::optional<snippet>> slots_;
+    std::vector<std::int64_t> ranks_;
+
+    std::priority_queue<edge> edges_;
+    std::size_t sequence_{0};
+    std::int64_t front_{0};
+
+    code_index index_;
+  };
+
+} // namespace details
+
+using snippet_t = details::snippet;
+using snippets_t = std::vector<snippet_t>;
+
+[[nodiscard]] inline snippet_t prepare(fgm::fragment&& fragment) {
+  return details::extract_single(std::move(fragment));
+}
 
-  std::vector<fgm::fragment> result{};
-  result.reserve(snippets.size());
+[[nodiscard]] std::vector<fgm::fragment> splice(snippets_t& snippets) {
+  details::graph graph{std::move(snippets)};
+  graph.match_all();
 
-  transform(snippets.begin(),
-            snippets.end(),
-            back_inserter(result),
-            [](auto& s) { return std::move(s.fragment_); });
+  while (graph.splice_next()) {
+  }
+
+  return graph.release();
+}
 
-  return result;
+template<typename Iter>
+[[nodiscard]] inline std::vector<fgm::fragment> splice(Iter first, Iter last) {
+  auto snippets{details::extract_all(first, last)};
+  return splice(snippets);
 }
 
 } // namespace fgs
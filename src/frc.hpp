@@ -8,8 +8,12 @@
 #include "kpe.hpp"
 #include "kpm.hpp"
 
+#include <algorithm>
+#include <cstdlib>
 #include <execution>
+#include <intrin.h>
 #include <list>
+#include <optional>
 
 namespace frc {
 
@@ -25,6 +29,92 @@ static inline constexpr std::size_t grid_overlap{16};
 
 using grid_type = kpr::grid<grid_horizontal, grid_vertical, allocator_t<char>>;
 
+// every audit_-th bounded match is checked against the full search
+struct prediction {
+  std::int32_t radius_;
+  std::size_t warmup_;
+  std::size_t audit_{8};
+};
+
+namespace details {
+  [[nodiscard]] inline bool same(image_type const& lhs,
+                                 image_type const& rhs) noexcept {
+    if (lhs.width() != rhs.width() || lhs.height() != rhs.height()) {
+      return false;
+    }
+
+    auto left{reinterpret_cast<std::uint8_t const*>(lhs.data())};
+    auto right{reinterpret_cast<std::uint8_t const*>(rhs.data())};
+
+    constexpr auto step{sizeof(__m256i)};
+
+    auto size{lhs.size() * sizeof(cpl::nat_cc)};
+    for (auto last{left + size - size % step}; left < last;
+         left += step, right += step) {
+      auto diff{_mm256_xor_si256(
+          _mm256_loadu_si256(reinterpret_cast<__m256i const*>(left)),
+          _mm256_loadu_si256(reinterpret_cast<__m256i const*>(right)))};
+
+      if (_mm256_testz_si256(diff, diff) == 0) {
+        return false;
+      }
+    }
+
+    return std::equal(left, left + size % step, right);
+  }
+
+  // constant velocity, trusted after a run of consistent matches
+  class predictor {
+  public:
+    inline explicit predictor(std::optional<prediction> const& config) noexcept
+        : config_{config} {
+    }
+
+    [[nodiscard]] inline std::optional<kpm::search_window>
+        predict() const noexcept {
+      if (!config_ || streak_ < config_->warmup_) {
+        return {};
+      }
+
+      return kpm::search_window{velocity_, config_->radius_};
+    }
+
+    // bounded result has to be confirmed by the full search
+    [[nodiscard]] inline bool audit() noexcept {
+      return config_->audit_ != 0 && ++bounded_ % config_->audit_ == 0;
+    }
+
+    inline void update(std::optional<cdt::offset_t> const& offset) noexcept {
+      if (!config_) {
+        return;
+      }
+
+      if (!offset) {
+        streak_ = 0;
+        return;
+      }
+
+      auto& radius{config_->radius_};
+      if (streak_ != 0 && std::abs(offset->x_ - velocity_.x_) <= radius &&
+          std::abs(offset->y_ - velocity_.y_) <= radius) {
+        ++streak_;
+      }
+      else {
+        streak_ = 1;
+      }
+
+      velocity_ = *offset;
+    }
+
+  private:
+    std::optional<prediction> config_;
+
+    cdt::offset_t velocity_{};
+    std::size_t streak_{0};
+    std::size_t bounded_{0};
+  };
+} // namespace details
+
 class collector {
 private:
   struct match_config {
@@ -32,37 +122,82 @@ private:
     static constexpr std::size_t weight_switch{10};
     static constexpr std::size_t region_votes{3};
 
-    inline explicit match_config(allocator_type const& alloc) noexcept
-        : allocator_{alloc} {
+    inline match_config(allocator_type const& alloc,
+                        kpm::histogram& histogram,
+                        std::optional<kpm::search_window> window = {}) noexcept
+        : allocator_{alloc}
+        , histogram_{&histogram}
+        , window_{window} {
     }
 
     [[nodiscard]] inline allocator_type get_allocator() const noexcept {
       return allocator_;
     }
 
+    [[nodiscard]] inline kpm::histogram& get_histogram() const noexcept {
+      return *histogram_;
+    }
+
+    [[nodiscard]] inline std::optional<kpm::search_window>
+        get_window() const noexcept {
+      return window_;
+    }
+
     [[no_unique_address]] allocator_type allocator_;
+    kpm::histogram* histogram_;
+
+    std::optional<kpm::search_window> window_;
   };
 
   using keypoint_extractor_t = kpe::extractor<grid_type, grid_overlap>;
 
   using pixel_alloc_t = allocator_t<cpl::nat_cc>;
 
+  struct retain {
+    inline void operator()(fgm::fragment&& /*unused*/) const noexcept {
+    }
+  };
+
+  // last distinct frame, kept alive while the feed repeats it
+  struct state {
+    image_type image_;
+    image_type median_;
+    grid_type keys_;
+  };
+
 public:
-  collector(mrl::dimensions_t dimensions)
-      : extractor_{dimensions} {
+  collector(mrl::dimensions_t dimensions,
+            std::optional<prediction> predict = {})
+      : extractor_{dimensions}
+      , predictor_{predict} {
   }
 
   template<typename Feeder, typename Comp, typename Callback>
-  void collect(Feeder&& feed, Comp&& comp, Callback&& cb) requires(
+  inline void collect(Feeder&& feed, Comp&& comp, Callback&& cb) requires(
       ifd::feeder<std::decay_t<Feeder>, pixel_alloc_t>&&
           icd::compressor<std::decay_t<Comp>, pixel_alloc_t>) {
-    if (feed.has_more()) {
-      all::memory_stack<cpl::nat_cc> memory{};
+    collect(std::forward<Feeder>(feed),
+            std::forward<Comp>(comp),
+            std::forward<Callback>(cb),
+            retain{});
+  }
 
-      auto pkeys{process_init(feed, comp, memory.previous())};
+  template<typename Feeder, typename Comp, typename Callback, typename Sink>
+  void collect(Feeder&& feed, Comp&& comp, Callback&& cb, Sink&& sink) requires(
+      ifd::feeder<std::decay_t<Feeder>, pixel_alloc_t>&&
+          icd::compressor<std::decay_t<Comp>, pixel_alloc_t>&&
+              std::invocable<Sink, fgm::fragment&&>) {
+    if (feed.has_more()) {
+      auto last{process_init(feed, comp, memory_.previous())};
       for (std::int32_t x{0}, y{0}; feed.has_more();) {
-        all::memory_swing swing{memory};
-        pkeys = process_frame(feed, comp, cb, pkeys, swing);
+        all::memory_swing swing{memory_};
+        if (auto next{process_frame(feed, comp, cb, sink, last, swing)};
+            next) {
+          last = std::move(*next);
+        }
+        else {
+          swing.hold();
+        }
       }
     }
   }
@@ -71,6 +206,10 @@ public:
     return *current_;
   }
 
+  [[nodiscard]] inline std::size_t allocations() const noexcept {
+    return memory_.allocations();
+  }
+
   [[nodiscard]] inline std::list<fgm::fragment> complete() noexcept {
     for (auto& fragment : fragments_) {
       fragment.normalize();
@@ -84,44 +223,98 @@ private:
   auto process_init(Feed& feed, Comp& comp, pixel_alloc_t const& alloc) {
     auto frame{feed.produce(alloc)};
 
-    add_fragment(frame.image_.dimensions());
+    add_fragment(frame.image_.dimensions(), retain{});
 
     image_type median{frame.image_.dimensions(), alloc};
-    auto result{extractor_.extract(frame.image_, median, alloc)};
+    auto keys{extractor_.extract(frame.image_, median, alloc)};
 
     blit(comp, frame, median);
 
-    return result;
+    return state{std::move(frame.image_), std::move(median), std::move(keys)};
   }
 
-  template<typename Feed, typename Comp, typename Callback>
-  auto process_frame(Feed& feed,
-                     Comp& comp,
-                     Callback&& cb,
-                     grid_type const& previous,
-                     pixel_alloc_t const& alloc) {
+  template<typename Feed, typename Comp, typename Callback, typename Sink>
+  std::optional<state> process_frame(Feed& feed,
+                                     Comp& comp,
+                                     Callback&& cb,
+                                     Sink&& sink,
+                                     state& last,
+                                     pixel_alloc_t const& alloc) {
     auto frame{feed.produce(alloc)};
+    if (details::same(frame.image_, last.image_)) {
+      process_repeat(frame, cb, last);
+      return {};
+    }
+
     auto& dim{frame.image_.dimensions()};
 
     image_type median{dim, alloc};
     auto keys{extractor_.extract(frame.image_, median, alloc)};
 
-    if (auto off{kpm::match(match_config{alloc}, previous, keys)}; off) {
+    if (auto off{match(last.keys_, keys, alloc)}; off) {
       position_.x_ += off->x_;
       position_.y_ += off->y_;
     }
     else {
-      add_fragment(dim);
+      add_fragment(dim, sink);
     }
 
     blit(comp, frame, median);
 
     cb(*current_, frame, median, keys);
 
-    return keys;
+    return state{std::move(frame.image_), std::move(median), std::move(keys)};
   }
 
-  inline void add_fragment(mrl::dimensions_t dimension) {
+  // a repeated frame cannot move, it adds one more contribution of the last
+  // distinct frame and is recorded with it
+  template<typename Callback>
+  void process_repeat(frame_type const& frame, Callback&& cb, state& last) {
+    predictor_.update(cdt::offset_t{});
+
+    current_->repeat(frame.image_, frame.number_);
+
+    cb(*current_, frame, last.median_, last.keys_);
+  }
+
+  [[nodiscard]] std::optional<cdt::offset_t>
+      match(grid_type const& previous,
+            grid_type const& current,
+            pixel_alloc_t const& alloc) {
+    std::optional<cdt::offset_t> bounded{};
+    if (auto window{predictor_.predict()}; window) {
+      bounded = kpm::match(
+          match_config{alloc, histogram_, window}, previous, current);
+
+      if (bounded && !predictor_.audit()) {
+        predictor_.update(bounded);
+        return bounded;
+      }
+    }
+
+    // an alias inside the window can beat the true offset outside of it, the
+    // full search wins when the two disagree
+    auto off{kpm::match(match_config{alloc, histogram_}, previous, current)};
+    if (!off) {
+      off = bounded;
+    }
+
+    predictor_.update(off);
+
+    return off;
+  }
+
+  template<typename Sink>
+  inline void add_fragment(mrl::dimensions_t dimension, Sink&& sink) {
+    if constexpr (!std::is_same_v<std::decay_t<Sink>, retain>) {
+      if (current_ != nullptr) {
+        current_->normalize();
+        sink(std::move(*current_));
+
+        fragments_.pop_back();
+      }
+    }
+
     current_ = &fragments_.emplace_back(dimension);
     position_.x_ = position_.y_ = 0;
   }
@@ -136,6 +329,9 @@ private:
 
 private:
   keypoint_extractor_t extractor_;
+  all::memory_stack<cpl::nat_cc> memory_;
+  kpm::histogram histogram_;
+  details::predictor predictor_;
 
   fgm::point_t position_{};
 
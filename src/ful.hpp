@@ -14,11 +14,13 @@ void write(std::filesystem::path dir, Iter first, Iter last) {
     std::fstream output{dir / std::to_string(i),
                         std::ios::out | std::ios::binary};
 
-    auto dim{first->dots().dimensions()};
+    auto dim{first->dimensions()};
     output.write(reinterpret_cast<char const*>(&dim), sizeof(dim));
 
-    output.write(reinterpret_cast<char const*>(first->dots().data()),
-                 first->dots().dimensions().area() * sizeof(fgm::dot_type));
+    first->rows([&output](fgm::dot_type const* row, std::size_t width) {
+      output.write(reinterpret_cast<char const*>(row),
+                   width * sizeof(fgm::dot_type));
+    });
 
     auto zero{first->zero()};
     output.write(reinterpret_cast<char const*>(&zero), sizeof(zero));
@@ -41,6 +43,11 @@ void write(std::filesystem::path dir, Iter first, Iter last) {
       output.write(reinterpret_cast<char const*>(&size_m), sizeof(size_m));
       output.write(reinterpret_cast<char const*>(frame.data_.median_.data()),
                    size_m);
+
+      auto size_r{frame.repeats_.size()};
+      output.write(reinterpret_cast<char const*>(&size_r), sizeof(size_r));
+      output.write(reinterpret_cast<char const*>(frame.repeats_.data()),
+                   size_r * sizeof(std::size_t));
     }
   }
 }
@@ -91,6 +98,12 @@ void write(std::filesystem::path dir, Iter first, Iter last) {
       frame.data_.median_.resize(size_m);
       input.read(reinterpret_cast<char*>(frame.data_.median_.data()), size_m);
 
+      std::size_t size_r{};
+      input.read(reinterpret_cast<char*>(&size_r), sizeof(size_r));
+      frame.repeats_.resize(size_r);
+      input.read(reinterpret_cast<char*>(frame.repeats_.data()),
+                 size_r * sizeof(std::size_t));
+
       frames.push_back(frame);
     }
 
@@ -25,4 +25,10 @@ concept decompressor = requires(Ty c) {
     } -> std::same_as<sid::nat::aimg_t<Alloc>>;
 };
 
+// decompresses into an image that already has the right dimensions
+template<typename Ty>
+concept buffered_decompressor = requires(Ty c, sid::nat::dimg_t& output) {
+  {c(std::declval<compressed_t>(), output)};
+};
+
 } // namespace icd
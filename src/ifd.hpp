@@ -8,6 +8,7 @@
 #include <concepts>
 #include <cstddef>
 #include <utility>
+#include <vector>
 
 namespace ifd {
 
@@ -27,4 +28,54 @@ concept feeder = requires(Ty a) {
     } -> std::same_as<frame<sid::nat::aimg_t<Alloc>>>;
 };
 
+template<typename Ty>
+concept croppable = requires(Ty a) {
+  {a.crop(std::declval<mrl::region_t const&>())};
+};
+
+using recording_t = std::vector<frame<sid::nat::dimg_t>>;
+
+template<croppable Feeder>
+class replay_feed {
+public:
+  using feeder_type = Feeder;
+
+public:
+  inline replay_feed(recording_t&& recorded,
+                     mrl::region_t const& crop,
+                     feeder_type& live)
+      : recorded_{std::move(recorded)}
+      , crop_{crop}
+      , live_{&live} {
+    live_->crop(crop_);
+  }
+
+  [[nodiscard]] inline bool has_more() const noexcept {
+    return next_ < recorded_.size() || live_->has_more();
+  }
+
+  template<typename Alloc>
+  [[nodiscard]] auto produce(Alloc const& alloc) {
+    using frame_type = frame<sid::nat::aimg_t<Alloc>>;
+
+    if (next_ < recorded_.size()) {
+      auto& [no, image]{recorded_[next_++]};
+
+      frame_type result{no, image.crop(crop_, alloc)};
+      image = {};
+
+      return result;
+    }
+
+    return live_->produce(alloc);
+  }
+
+private:
+  recording_t recorded_;
+  std::size_t next_{0};
+
+  mrl::region_t crop_;
+  feeder_type* live_;
+};
+
 } // namespace ifd
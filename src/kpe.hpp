@@ -89,8 +89,9 @@ public:
       , reg_mid_stride_{dimensions.height_ * reg_overlap} {
   }
 
+  template<typename Alloc>
   [[nodiscard]] grid_type
-      extract(matrix_type const& image,
+      extract(sid::nat::aimg_t<Alloc> const& image,
               matrix_type& median,
               typename grid_type::allocator_type const& alloc) {
     grid_type grid{alloc};
@@ -103,6 +104,7 @@ public:
     }
 
     col_out(image, median, grid);
+    grid.seal();
 
     return grid;
   }
@@ -146,7 +148,10 @@ private:
     }
   }
 
-  void col_out(matrix_type const& image, matrix_type& median, grid_type& grid) {
+  template<typename Alloc>
+  void col_out(sid::nat::aimg_t<Alloc> const& image,
+               matrix_type& median,
+               grid_type& grid) {
     auto start{image.data() + image.width() * kernel_half};
     auto raw{start + kernel_half};
     auto out{median.data() + (median.width() + 1) * kernel_half};
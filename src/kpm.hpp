@@ -10,6 +10,9 @@
 #include <algorithm>
 #include <array>
 #include <concepts>
+#include <cstddef>
+#include <intrin.h>
+#include <limits>
 #include <memory>
 #include <numeric>
 #include <optional>
@@ -75,19 +78,184 @@ using totalizator_t =
                        std::equal_to<cdt::offset_t>,
                        all::rebind_alloc_t<Alloc, vote::pair_t>>;
 
-using cellular_totalizator_t =
-    std::unordered_map<cdt::offset_t,
-                       totalizator_t<std::allocator<char>>,
-                       cdt::offset_hash>;
+using cell_totalizator_t = totalizator_t<all::arena_allocator<char>>;
+
+// allocated from the innermost all::arena_scope
+using cellular_totalizator_t = std::unordered_map<
+    cdt::offset_t,
+    cell_totalizator_t,
+    cdt::offset_hash,
+    std::equal_to<cdt::offset_t>,
+    all::arena_allocator<std::pair<cdt::offset_t const, cell_totalizator_t>>>;
 
 using cell_size_t = cdt::dimensions<std::uint8_t>;
 
+struct search_window {
+  cdt::offset_t center_;
+  std::int32_t radius_;
+};
+
+// dense offset votes, saturating at the counter limit
+class histogram {
+public:
+  using count_type = std::uint16_t;
+
+  static inline constexpr std::size_t lanes{sizeof(__m256i) /
+                                            sizeof(count_type)};
+  static inline constexpr count_type limit{
+      std::numeric_limits<count_type>::max()};
+
+public:
+  // offsets outside of the window, when one is given, are not counted
+  template<typename Bounds>
+  void reset(Bounds const& previous,
+             Bounds const& current,
+             std::optional<search_window> const& window = {}) {
+    auto& [plow, phigh]{previous};
+    auto& [clow, chigh]{current};
+
+    auto delta{[](auto lhs, auto rhs) {
+      return static_cast<std::int32_t>(lhs) - static_cast<std::int32_t>(rhs);
+    }};
+
+    cdt::offset_t low{delta(plow.x_, chigh.x_), delta(plow.y_, chigh.y_)};
+    cdt::offset_t high{delta(phigh.x_, clow.x_), delta(phigh.y_, clow.y_)};
+
+    if (bounded_ = window.has_value(); bounded_) {
+      auto& [center, radius]{*window};
+
+      low = {std::max(low.x_, center.x_ - radius),
+             std::max(low.y_, center.y_ - radius)};
+      high = {std::min(high.x_, center.x_ + radius),
+              std::min(high.y_, center.y_ + radius)};
+    }
+
+    low_ = low;
+    width_ = high.x_ < low.x_ ? 0 : high.x_ - low.x_ + 1;
+    height_ = high.y_ < low.y_ ? 0 : high.y_ - low.y_ + 1;
+
+    size_ = (width_ * height_ + lanes - 1) / lanes * lanes;
+    if (counts_.size() < size_) {
+      counts_.resize(size_);
+    }
+
+    std::fill_n(counts_.begin(), size_, count_type{0});
+  }
+
+  template<typename Points>
+  inline void add(Points const& previous, Points const& current) noexcept {
+    if (bounded_) {
+      count<true>(previous, current);
+    }
+    else {
+      count<false>(previous, current);
+    }
+  }
+
+  template<typename Ticket>
+  void select(Ticket& selected) const {
+    auto top{selected.size()};
+    auto data{counts_.data()};
+
+    std::size_t found{0};
+
+    count_type threshold{0};
+    auto bound{_mm256_set1_epi16(1)};
+
+    for (std::size_t i{0}; i < size_ && threshold != limit; i += lanes) {
+      auto block{
+          _mm256_loadu_si256(reinterpret_cast<__m256i const*>(data + i))};
+
+      if (_mm256_movemask_epi8(_mm256_cmpeq_epi16(
+              _mm256_max_epu16(block, bound), block)) == 0) {
+        continue;
+      }
+
+      for (auto j{i}; j < i + lanes; ++j) {
+        if (auto count{data[j]}; count > threshold) {
+          auto k{std::min(found++, top - 1)};
+          for (; k != 0 && count > selected[k - 1].count_; --k) {
+            selected[k] = selected[k - 1];
+          }
+
+          selected[k] = vote{offset(j), count};
+          if (found >= top) {
+            threshold = static_cast<count_type>(selected[top - 1].count_);
+            bound = _mm256_set1_epi16(static_cast<short>(threshold + 1));
+          }
+        }
+      }
+    }
+
+    selected.resize(std::min(found, top));
+  }
+
+private:
+  template<bool Bounded, typename Points>
+  void count(Points const& previous, Points const& current) noexcept {
+    auto data{counts_.data()};
+    auto stride{static_cast<std::ptrdiff_t>(width_)};
+
+    for (auto& [px, py] : previous) {
+      auto ox{static_cast<std::ptrdiff_t>(px) - low_.x_};
+      auto oy{static_cast<std::ptrdiff_t>(py) - low_.y_};
+
+      for (auto& [cx, cy] : current) {
+        auto x{ox - static_cast<std::ptrdiff_t>(cx)};
+        auto y{oy - static_cast<std::ptrdiff_t>(cy)};
+
+        if constexpr (Bounded) {
+          if (static_cast<std::size_t>(x) >= width_ ||
+              static_cast<std::size_t>(y) >= height_) {
+            continue;
+          }
+        }
+
+        auto& count{data[y * stride + x]};
+        count += count != limit;
+      }
+    }
+  }
+
+  [[nodiscard]] inline cdt::offset_t offset(std::size_t index) const noexcept {
+    return {low_.x_ + static_cast<std::int32_t>(index % width_),
+            low_.y_ + static_cast<std::int32_t>(index / width_)};
+  }
+
+private:
+  std::vector<count_type> counts_;
+
+  cdt::offset_t low_{};
+  std::size_t width_{0};
+  std::size_t height_{0};
+  std::size_t size_{0};
+
+  bool bounded_{false};
+};
+
+template<typename Ty>
+concept dense_config = match_config<Ty> && requires(Ty cfg) {
+  { cfg.get_histogram() } -> std::same_as<histogram&>;
+};
+
+template<typename Ty>
+concept bounded_config = dense_config<Ty> && requires(Ty cfg) {
+  { cfg.get_window() } -> std::convertible_to<std::optional<search_window>>;
+};
+
 namespace details {
 
   template<typename Alloc>
   using collector_t =
       std::vector<ticket_t<Alloc>, all::rebind_alloc_t<Alloc, ticket_t<Alloc>>>;
 
+  template<typename Points>
+  inline void get_offsets(Points const& previous,
+                          Points const& current,
+                          histogram& total) noexcept {
+    total.add(previous, current);
+  }
+
   template<typename Total, typename Points>
   void
       get_offsets(Points const& previous, Points const& current, Total& total) {
@@ -102,24 +270,36 @@ namespace details {
     }
   }
 
-  template<bool Switch, match_config Cfg, typename Region>
-  [[nodiscard]] auto count_offsets(Cfg const& config,
-                                   Region const& previous,
-                                   Region const& current) {
-    totalizator_t<config_alloc_t<Cfg>> total{config.get_allocator()};
+  template<typename Region, typename Fn>
+  void join(Region const& previous, Region const& current, Fn&& fn) {
+    for (auto& grp : current.groups()) {
+      if (auto found{previous.find(grp)}; found != nullptr) {
+        fn(grp.key_, previous.points(*found), current.points(grp));
+      }
+    }
+  }
 
-    auto& prev_group{previous.points()};
-    for (auto& [key, curr] : current.points()) {
+  template<bool Switch, typename Total, typename Region>
+  void count_offsets(Total& total,
+                     Region const& previous,
+                     Region const& current) {
+    join(previous, current, [&total](auto& key, auto prev, auto curr) {
       if constexpr (!Switch) {
         if (kpr::weight(key) != std::byte{2}) {
-          continue;
+          return;
         }
       }
 
-      if (auto it = prev_group.find(key); it != prev_group.end()) {
-        get_offsets(it->second, curr, total);
-      }
-    }
+      get_offsets(prev, curr, total);
+    });
+  }
+
+  template<bool Switch, match_config Cfg, typename Region>
+  [[nodiscard]] auto count_offsets(Cfg const& config,
+                                   Region const& previous,
+                                   Region const& current) {
+    totalizator_t<config_alloc_t<Cfg>> total{config.get_allocator()};
+    count_offsets<Switch>(total, previous, current);
 
     return total;
   }
@@ -164,9 +344,32 @@ namespace details {
                      Region const& previous,
                      Region const& current,
                      std::bool_constant<Switch> /*unused*/) {
-    return top_offsets(config,
-                       count_offsets<Switch>(config, previous, current),
-                       Cfg::region_votes);
+    if constexpr (dense_config<Cfg>) {
+      ticket_t<config_alloc_t<Cfg>> selected{Cfg::region_votes,
+                                             config.get_allocator()};
+      if (previous.points().empty() || current.points().empty()) {
+        selected.clear();
+        return selected;
+      }
+
+      auto& total{config.get_histogram()};
+      if constexpr (bounded_config<Cfg>) {
+        total.reset(previous.bounds(), current.bounds(), config.get_window());
+      }
+      else {
+        total.reset(previous.bounds(), current.bounds());
+      }
+
+      count_offsets<Switch>(total, previous, current);
+      total.select(selected);
+
+      return selected;
+    }
+    else {
+      return top_offsets(config,
+                         count_offsets<Switch>(config, previous, current),
+                         Cfg::region_votes);
+    }
   }
 
   template<match_config Cfg>
@@ -196,9 +399,21 @@ namespace details {
     return count;
   }
 
+  template<match_config Cfg>
+  [[nodiscard]] inline bool is_bounded(Cfg const& config) noexcept {
+    if constexpr (bounded_config<Cfg>) {
+      return config.get_window().has_value();
+    }
+    else {
+      return false;
+    }
+  }
+
+  // bounded searches cannot see competitors outside of the window, so their
+  // winner also has to collect at least twice the votes of the runner-up
   template<typename Tickets>
   [[nodiscard]] inline std::optional<cdt::offset_t>
-      declare(Tickets const& top, std::size_t region_count) {
+      declare(Tickets const& top, std::size_t region_count, bool bounded) {
     if (top.empty()) {
       return {};
     }
@@ -207,6 +422,10 @@ namespace details {
       return {};
     }
 
+    if (bounded && top.size() > 1 && top[0].count_ < 2 * top[1].count_) {
+      return {};
+    }
+
     return {top[0].offset_};
   }
 
@@ -253,12 +472,9 @@ namespace details {
                     cell_size_t const& cell_size) {
     cellular_totalizator_t total;
 
-    auto& prev_group{previous.points()};
-    for (auto& [key, curr] : current.points()) {
-      if (auto it = prev_group.find(key); it != prev_group.end()) {
-        get_offsets(it->second, curr, total, cell_size);
-      }
-    }
+    join(previous, current, [&total, &cell_size](auto&, auto prev, auto curr) {
+      get_offsets(prev, curr, total, cell_size);
+    });
 
     return total;
   }
@@ -325,21 +541,19 @@ namespace details {
         cdt::offset_t,
         cdt::offset_hash,
         std::equal_to<cdt::offset_t>,
-        all::rebind_alloc_t<typename Region::allocator_type, cdt::offset_t>>
-        cells{region.get_allocator()};
+        all::arena_allocator<cdt::offset_t>>
+        cells{};
 
     auto& [cx, cy]{cell_size};
-    for (auto const& [key, group] : region.points()) {
-      for (auto point : group) {
-        if (limits.contains(point)) {
-          if (auto idx{to_index(static_cast<cdt::offset_t>(point) + delta,
-                                mask.dimensions())};
-              value(mask.data()[idx]) != 0) {
-            auto ox{static_cast<std::int32_t>(point.x_ - limits.left_) / cx};
-            auto oy{static_cast<std::int32_t>(point.y_ - limits.top_) / cy};
-
-            cells.emplace(ox * cx, oy * cy);
-          }
+    for (auto point : region.points()) {
+      if (limits.contains(point)) {
+        if (auto idx{to_index(static_cast<cdt::offset_t>(point) + delta,
+                              mask.dimensions())};
+            value(mask.data()[idx]) != 0) {
+          auto ox{static_cast<std::int32_t>(point.x_ - limits.left_) / cx};
+          auto oy{static_cast<std::int32_t>(point.y_ - limits.top_) / cy};
+
+          cells.emplace(ox * cx, oy * cy);
         }
       }
     }
@@ -376,6 +590,12 @@ template<typename Region>
                                         cell_size_t const& cell_size) {
   using namespace details;
 
+  // totalizators need an arena, callers that did not open one get a local one
+  std::optional<all::arena_scope> arena{};
+  if (!all::arena_scope::active()) {
+    arena.emplace();
+  }
+
   auto offsets{count_offsets(preg, creg, cell_size)};
   if (offsets.empty()) {
     return {};
@@ -411,7 +631,9 @@ template<match_config Cfg, typename Grid>
     tickets.push_back(cast_vote(config, prev_regs[i], curr_regs[i]));
   }
 
-  return declare(top_offsets(config, count<Cfg>(tickets), 2), active);
+  return declare(top_offsets(config, count<Cfg>(tickets), 2),
+                 active,
+                 is_bounded(config));
 }
 
 } // namespace kpm
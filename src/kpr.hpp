@@ -3,17 +3,23 @@
 
 #pragma once
 
+#include "all.hpp"
 #include "mrl.hpp"
 
+#include <algorithm>
 #include <array>
+#include <bit>
+#include <cassert>
 #include <concepts>
 #include <cstddef>
+#include <cstring>
+#include <limits>
 #include <memory>
 #include <numeric>
 #include <span>
 #include <type_traits>
-#include <unordered_map>
 #include <utility>
+#include <vector>
 
 namespace kpr {
 
@@ -38,6 +44,15 @@ struct code_hash {
 };
 
 namespace details {
+  [[nodiscard]] inline std::uint32_t mix(code const& value) noexcept {
+    std::uint64_t head{}, tail{};
+    std::memcpy(&head, value.data(), sizeof(head));
+    std::memcpy(&tail, value.data() + code_length - sizeof(tail), sizeof(tail));
+
+    auto mixed{(head ^ std::rotl(tail, 29)) * 0x9e3779b97f4a7c15ULL};
+    return static_cast<std::uint32_t>(mixed >> 32);
+  }
+
   template<typename Idxs, typename Jdxs>
   struct join_sequences_help;
 
@@ -94,43 +109,124 @@ template<typename Alloc>
 class region {
 public:
   static inline constexpr std::size_t max_weight{3};
+  static inline constexpr std::size_t initial_slots{1024};
 
   using allocator_type = Alloc;
 
-  using points_t = std::vector<mrl::point_t>;
+  struct group {
+    code key_;
+    std::uint32_t hash_;
+    std::uint32_t first_;
+    std::uint32_t count_;
+  };
+
+  using points_t = std::span<mrl::point_t const>;
+  using groups_t = std::span<group const>;
 
-  using points_alloc_t =
-      all::rebind_alloc_t<allocator_type, std::pair<code const, points_t>>;
+  using bounds_t = std::pair<mrl::point_t, mrl::point_t>;
 
-  using points_store = std::unordered_map<code,
-                                          points_t,
-                                          code_hash,
-                                          std::equal_to<code>,
-                                          points_alloc_t>;
+  using points_store =
+      std::vector<mrl::point_t,
+                  all::rebind_alloc_t<allocator_type, mrl::point_t>>;
+  using groups_store =
+      std::vector<group, all::rebind_alloc_t<allocator_type, group>>;
+  using index_store =
+      std::vector<std::uint32_t,
+                  all::rebind_alloc_t<allocator_type, std::uint32_t>>;
   using count_store = std::array<std::size_t, max_weight>;
 
 public:
   inline region(allocator_type const& alloc)
-      : points_{points_alloc_t{alloc}} {
+      : groups_{alloc}
+      , slots_{alloc}
+      , tags_{alloc}
+      , staged_{alloc}
+      , points_{alloc} {
   }
 
   inline region()
       : region(allocator_type{}) {
   }
 
+  // points cannot be added once the region is sealed, until it is cleared
   inline void add(code const& key, mrl::point_t const& point) {
-    points_[key].push_back(point);
+    assert(!sealed_);
+
+    auto tag{insert(key)};
+
+    ++groups_[tag].count_;
+    tags_.push_back(tag);
+    staged_.push_back(point);
+
     ++weight_count_[static_cast<std::size_t>(weight(key))];
   }
 
+  // lays out points of each group contiguously, in the order of insertion,
+  // sealing again has no effect
+  void seal() {
+    if (std::exchange(sealed_, true)) {
+      return;
+    }
+
+    std::uint32_t offset{0};
+    for (auto& grp : groups_) {
+      grp.first_ = offset;
+      offset += std::exchange(grp.count_, 0);
+    }
+
+    auto& [low, high]{bounds_};
+
+    points_.resize(staged_.size());
+    for (std::size_t i{0}; i < staged_.size(); ++i) {
+      auto& point{staged_[i]};
+
+      auto& grp{groups_[tags_[i]]};
+      points_[grp.first_ + grp.count_++] = point;
+
+      low = {std::min(low.x_, point.x_), std::min(low.y_, point.y_)};
+      high = {std::max(high.x_, point.x_), std::max(high.y_, point.y_)};
+    }
+
+    tags_.clear();
+    staged_.clear();
+  }
+
   inline void clear() noexcept {
+    groups_.clear();
+    slots_.clear();
+    tags_.clear();
+    staged_.clear();
     points_.clear();
+
+    bounds_ = empty_bounds();
+    sealed_ = false;
+  }
+
+  [[nodiscard]] inline group const* find(group const& other) const noexcept {
+    return find(other.key_, other.hash_);
   }
 
-  [[nodiscard]] inline points_store const& points() const noexcept {
+  [[nodiscard]] inline group const* find(code const& key) const noexcept {
+    return find(key, details::mix(key));
+  }
+
+  [[nodiscard]] inline groups_t groups() const noexcept {
+    return groups_;
+  }
+
+  [[nodiscard]] inline points_t points() const noexcept {
     return points_;
   }
 
+  [[nodiscard]] inline points_t points(group const& grp) const noexcept {
+    return points_t{points_}.subspan(grp.first_, grp.count_);
+  }
+
+  // smallest and largest coordinates of sealed points
+  [[nodiscard]] inline bounds_t const& bounds() const noexcept {
+    return bounds_;
+  }
+
   [[nodiscard]] inline count_store const& counts() const noexcept {
     return weight_count_;
   }
@@ -151,7 +247,73 @@ public:
   }
 
 private:
+  [[nodiscard]] static inline bounds_t empty_bounds() noexcept {
+    constexpr auto limit{std::numeric_limits<mrl::size_type>::max()};
+    return {{limit, limit}, {0, 0}};
+  }
+
+  [[nodiscard]] group const* find(code const& key,
+                                  std::uint32_t hash) const noexcept {
+    if (slots_.empty()) {
+      return nullptr;
+    }
+
+    for (auto mask{slots_.size() - 1}, i{hash & mask}; slots_[i] != 0;
+         i = (i + 1) & mask) {
+      if (auto& grp{groups_[slots_[i] - 1]};
+          grp.hash_ == hash && grp.key_ == key) {
+        return &grp;
+      }
+    }
+
+    return nullptr;
+  }
+
+  [[nodiscard]] std::uint32_t insert(code const& key) {
+    if ((groups_.size() + 1) * 2 > slots_.size()) {
+      rehash(std::max(slots_.size() * 2, initial_slots));
+    }
+
+    auto hash{details::mix(key)};
+
+    auto mask{slots_.size() - 1}, i{hash & mask};
+    for (; slots_[i] != 0; i = (i + 1) & mask) {
+      if (auto tag{slots_[i] - 1};
+          groups_[tag].hash_ == hash && groups_[tag].key_ == key) {
+        return tag;
+      }
+    }
+
+    groups_.push_back({key, hash, 0, 0});
+    slots_[i] = static_cast<std::uint32_t>(groups_.size());
+
+    return slots_[i] - 1;
+  }
+
+  void rehash(std::size_t size) {
+    slots_.assign(size, 0);
+
+    auto mask{size - 1};
+    for (std::uint32_t tag{0}; tag < groups_.size(); ++tag) {
+      auto i{groups_[tag].hash_ & mask};
+      for (; slots_[i] != 0; i = (i + 1) & mask) {
+      }
+
+      slots_[i] = tag + 1;
+    }
+  }
+
+private:
+  groups_store groups_;
+  index_store slots_;
+
+  index_store tags_;
+  points_store staged_;
+
   points_store points_;
+  bounds_t bounds_{empty_bounds()};
+  bool sealed_{false};
+
   count_store weight_count_{};
 };
 
@@ -205,6 +367,12 @@ public:
     return regions_[index];
   }
 
+  inline void seal() {
+    for (auto& region : regions_) {
+      region.seal();
+    }
+  }
+
 private:
   template<typename... Idxs>
   inline void add_intern(code const& key, mrl::point_t point, Idxs... idxs) {
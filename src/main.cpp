@@ -1,7 +1,9 @@
 ﻿
 
+#include "cca.hpp"
 #include "mpb.hpp"
 #include "nic.hpp"
+#include "pfd.hpp"
 
 #include "ful.hpp"
 #include "nil.hpp"
@@ -10,47 +12,34 @@
 #include <format>
 #include <fstream>
 #include <iostream>
+#include <string_view>
 
 using file_list = std::vector<std::filesystem::path>;
 
-class file_feed {
+class file_reader {
 public:
-  inline file_feed(mrl::dimensions_t const& dimensions,
-                   file_list const& files,
-                   std::optional<mrl::region_t> crop = {})
+  inline file_reader(mrl::dimensions_t const& dimensions,
+                     file_list const& files)
       : dimensions_{dimensions}
-      , files_{files}
-      , next_{files_.begin()}
-      , crop_{crop} {
+      , files_{files} {
   }
 
-  [[nodiscard]] inline bool has_more() const noexcept {
-    return next_ != files_.end();
+  [[nodiscard]] inline std::size_t size() const noexcept {
+    return files_.size();
   }
 
-  template<typename Alloc>
-  [[nodiscard]] auto produce(Alloc const& alloc) {
-    using image_type = sid::nat::aimg_t<Alloc>;
-    using frame_type = ifd::frame<image_type>;
-
-    auto temp{nil::read_raw(*(next_++), dimensions_, alloc)};
-    return frame_type{frame_number(), crop_ ? temp.crop(*crop_) : temp};
-  }
-
-private:
-  [[nodiscard]] inline std::size_t frame_number() const {
-    return static_cast<std::size_t>(next_ - files_.begin() - 1);
+  [[nodiscard]] inline bool operator()(std::size_t index,
+                                       cpl::nat_cc* output) const {
+    return nil::read_raw(files_[index], dimensions_, output);
   }
 
 private:
   mrl::dimensions_t dimensions_;
-
   file_list files_;
-  file_list::iterator next_;
-
-  std::optional<mrl::region_t> crop_;
 };
 
+using prefetch_feed = pfd::feed<file_reader>;
+
 class perf_counter {
 public:
   inline perf_counter(std::string name, std::size_t sample_size)
@@ -122,6 +111,11 @@ public:
                  mrl::dimensions_t const& dim) const {
     return nic::decompress(compressed, dim);
   }
+
+  void operator()(icd::compressed_t const& compressed,
+                  sid::nat::dimg_t& output) const {
+    nic::decompress(compressed, output);
+  }
 };
 
 struct aws_callback {
@@ -183,6 +177,10 @@ struct mpb_callbacks {
   inline void operator()(std::string const& tag,
                          std::vector<fgm::fragment> const& end) const noexcept {
   }
+
+  inline void operator()(std::string const& tag,
+                         fgs::snippets_t const& snippets) const noexcept {
+  }
 };
 
 struct callbacks : aws_callback,
@@ -191,33 +189,32 @@ struct callbacks : aws_callback,
                    arf_callback,
                    mpb_callbacks {};
 
-class build_adapter {
+[[nodiscard]] file_list list_files(std::filesystem::path const& root) {
+  using namespace std::filesystem;
+
+  file_list files{};
+  std::copy(
+      directory_iterator{root}, directory_iterator{}, std::back_inserter(files));
+
+  std::sort(files.begin(), files.end(), [](auto& a, auto& b) {
+    return stoi(a.filename().string()) < stoi(b.filename().string());
+  });
+
+  return files;
+}
+
+class adapter_base {
 public:
   using callbacks_type = callbacks;
-  using feed_type = file_feed;
 
-  static constexpr mrl::dimensions_t screen_dimensions{388, 312};
   static constexpr float artifact_filter_dev{2.0f};
   using artifact_filter_size = arf::filter_size<15>;
 
-public:
-  inline explicit build_adapter(std::filesystem::path const& root) {
-    using namespace std::filesystem;
-    std::copy(directory_iterator{root},
-              directory_iterator{},
-              std::back_inserter(files_));
+  static constexpr frc::prediction motion_prediction{16, 3};
 
-    std::sort(files_.begin(), files_.end(), [](auto& a, auto& b) {
-      return stoi(a.filename().string()) < stoi(b.filename().string());
-    });
-  }
-
-  [[nodiscard]] inline feed_type get_feed() const {
-    return {screen_dimensions, files_};
-  }
-
-  [[nodiscard]] inline feed_type get_feed(mrl::region_t crop) const {
-    return {screen_dimensions, files_, crop};
+public:
+  inline explicit adapter_base(mrl::dimensions_t const& dimensions) noexcept
+      : screen_dimensions_{dimensions} {
   }
 
   [[nodiscard]] inline native_compression get_compression() const {
@@ -226,31 +223,89 @@ public:
 
   [[nodiscard]] inline mrl::dimensions_t
       get_screen_dimensions() const noexcept {
-    return screen_dimensions;
+    return screen_dimensions_;
   }
 
   [[nodiscard]] inline float get_artifact_filter_dev() const noexcept {
     return artifact_filter_dev;
   }
 
+  [[nodiscard]] inline std::optional<frc::prediction>
+      get_motion_prediction() const noexcept {
+    return motion_prediction;
+  }
+
   [[nodiscard]] inline callbacks_type& get_callbacks() noexcept {
     return callbacks_;
   }
 
 private:
-  file_list files_;
+  mrl::dimensions_t screen_dimensions_;
 
   callbacks_type callbacks_{};
 };
 
+class build_adapter : public adapter_base {
+public:
+  using feed_type = prefetch_feed;
+
+  static constexpr mrl::dimensions_t screen_dimensions{388, 312};
+  static constexpr std::size_t prefetch_depth{8};
+
+public:
+  inline explicit build_adapter(std::filesystem::path const& root)
+      : adapter_base{screen_dimensions}
+      , files_{list_files(root)} {
+  }
+
+  [[nodiscard]] inline feed_type get_feed() const {
+    return {screen_dimensions,
+            file_reader{screen_dimensions, files_},
+            prefetch_depth};
+  }
+
+  [[nodiscard]] inline feed_type get_feed(mrl::region_t crop) const {
+    return {screen_dimensions,
+            file_reader{screen_dimensions, files_},
+            prefetch_depth,
+            crop};
+  }
+
+private:
+  file_list files_;
+};
+
+class archive_adapter : public adapter_base {
+public:
+  using feed_type = cca::feed;
+
+public:
+  inline explicit archive_adapter(std::shared_ptr<cca::archive const> archive)
+      : adapter_base{archive->dimensions()}
+      , archive_{std::move(archive)} {
+  }
+
+  [[nodiscard]] inline feed_type get_feed() const {
+    return feed_type{archive_};
+  }
+
+  [[nodiscard]] inline feed_type get_feed(mrl::region_t crop) const {
+    return feed_type{archive_, crop};
+  }
+
+private:
+  std::shared_ptr<cca::archive const> archive_;
+};
+
 void write_rgb(std::filesystem::path const& filename,
                mrl::matrix<cpl::rgb_bc> const& image) {
   png::write(filename, image.width(), image.height(), image.data());
 }
 
-void build(std::filesystem::path const& dir) {
-  mpb::builder builder{build_adapter{dir}};
-  auto results{builder.build()};
+template<typename Adapter>
+void build_maps(Adapter const& adapter) {
+  mpb::builder builder{adapter};
+  auto results{builder.build(mpb::mode::pipelined | mpb::mode::fused)};
 
   std::size_t i{};
   for (auto& result : results) {
@@ -259,8 +314,28 @@ void build(std::filesystem::path const& dir) {
   }
 }
 
+void build(std::filesystem::path const& input) {
+  if (std::filesystem::is_directory(input)) {
+    build_maps(build_adapter{input});
+  }
+  else {
+    build_maps(archive_adapter{std::make_shared<cca::archive const>(input)});
+  }
+}
+
+void pack(std::filesystem::path const& dir,
+          std::filesystem::path const& output) {
+  file_reader reader{build_adapter::screen_dimensions, list_files(dir)};
+  cca::write(output, build_adapter::screen_dimensions, reader);
+}
+
 int main(int argc, char* argv[]) {
-  build(argv[1]);
+  if (argc > 3 && std::string_view{argv[1]} == "pack") {
+    pack(argv[2], argv[3]);
+  }
+  else {
+    build(argv[1]);
+  }
 
   return 0;
 }
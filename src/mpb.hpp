@@ -9,8 +9,146 @@
 #include "fgs.hpp"
 #include "frc.hpp"
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
 namespace mpb {
 
+enum class mode : std::uint8_t {
+  sequential = 0,
+  pipelined = 1,
+  fused = 2,
+  pyramid = 4
+};
+
+[[nodiscard]] inline constexpr mode operator|(mode lhs, mode rhs) noexcept {
+  return static_cast<mode>(static_cast<std::uint8_t>(lhs) |
+                           static_cast<std::uint8_t>(rhs));
+}
+
+[[nodiscard]] inline constexpr bool has_mode(mode selected,
+                                             mode tested) noexcept {
+  return (static_cast<std::uint8_t>(selected) &
+          static_cast<std::uint8_t>(tested)) != 0;
+}
+
+namespace details {
+  // prepares snippets on a fixed set of workers, dispatch blocks while the
+  // queue is full, which bounds the fragments waiting for a worker but not
+  // the memory, every prepared snippet is kept until finish
+  class preparer {
+  public:
+    inline explicit preparer(std::size_t workers)
+        : capacity_{workers} {
+      for (std::size_t i{0}; i < workers; ++i) {
+        workers_.emplace_back([this](std::stop_token token) { work(token); });
+      }
+    }
+
+    preparer(preparer const&) = delete;
+    preparer& operator=(preparer const&) = delete;
+
+    void dispatch(fgm::fragment&& fragment) {
+      {
+        std::unique_lock lock{mutex_};
+        space_.wait(lock, [this] { return queue_.size() < capacity_; });
+
+        queue_.push_back({results_.size(), std::move(fragment)});
+        results_.emplace_back();
+      }
+
+      ready_.notify_one();
+    }
+
+    // snippets are returned in dispatch order
+    [[nodiscard]] fgs::snippets_t finish() {
+      std::unique_lock lock{mutex_};
+      done_.wait(lock, [this] { return completed_ == results_.size(); });
+
+      if (error_) {
+        std::rethrow_exception(error_);
+      }
+
+      fgs::snippets_t result{};
+      result.reserve(results_.size());
+      for (auto& snippet : results_) {
+        result.push_back(std::move(*snippet));
+      }
+
+      results_.clear();
+      completed_ = 0;
+
+      return result;
+    }
+
+  private:
+    struct job {
+      std::size_t index_;
+      fgm::fragment fragment_;
+    };
+
+    void work(std::stop_token token) {
+      while (true) {
+        std::optional<job> current{};
+        {
+          std::unique_lock lock{mutex_};
+          if (!ready_.wait(lock, token, [this] { return !queue_.empty(); })) {
+            return;
+          }
+
+          current.emplace(std::move(queue_.front()));
+          queue_.pop_front();
+        }
+
+        space_.notify_one();
+
+        std::optional<fgs::snippet_t> snippet{};
+        std::exception_ptr error{};
+        try {
+          snippet.emplace(fgs::prepare(std::move(current->fragment_)));
+        }
+        catch (...) {
+          error = std::current_exception();
+        }
+
+        {
+          std::lock_guard lock{mutex_};
+          results_[current->index_] = std::move(snippet);
+          if (error && !error_) {
+            error_ = error;
+          }
+
+          ++completed_;
+        }
+
+        done_.notify_all();
+      }
+    }
+
+  private:
+    std::size_t capacity_;
+
+    std::mutex mutex_;
+    std::condition_variable_any ready_;
+    std::condition_variable space_;
+    std::condition_variable done_;
+
+    std::deque<job> queue_;
+    std::vector<std::optional<fgs::snippet_t>> results_;
+    std::size_t completed_{0};
+    std::exception_ptr error_;
+
+    std::vector<std::jthread> workers_;
+  };
+} // namespace details
+
 template<typename Adapter>
 class builder {
 public:
@@ -20,38 +158,95 @@ private:
   using callbacks_type = typename Adapter::callbacks_type;
   using feed_type = typename Adapter::feed_type;
 
+  // bytes of raw frames kept while scanning for the window
+  static constexpr std::size_t replay_budget{32 << 20};
+
 public:
   inline builder(adapter_type const& adapter) noexcept
       : adapter_{adapter} {
   }
 
-  [[nodiscard]] std::vector<sid::nat::dimg_t> build() {
-    if (auto window{get_window()}; window) {
-      auto dimensions{window->bounds().dimensions()};
+  [[nodiscard]] std::vector<sid::nat::dimg_t>
+      build(mode selected = mode::sequential) {
+    if constexpr (ifd::croppable<feed_type>) {
+      if (has_mode(selected, mode::fused)) {
+        return build_fused(selected);
+      }
+    }
 
+    if (auto window{get_window(selected)}; window) {
       auto feed{adapter_.get_feed(window->margins())};
-
-      auto fragments{collect(feed, dimensions)};
-      auto spliced{splice(fragments)};
-      auto filtered{filter(dimensions, spliced)};
-      return clean(filtered);
+      return build(feed, *window, selected);
     }
 
     return {};
   }
 
 private:
-  [[nodiscard]] inline auto get_window() {
-    auto result{
-        aws::scan(adapter_.get_feed(), adapter_.get_screen_dimensions(), cb())};
+  [[nodiscard]] std::vector<sid::nat::dimg_t> build_fused(mode selected) {
+    aws::recorder recorder{replay_budget /
+                           adapter_.get_screen_dimensions().area()};
+
+    auto feed{adapter_.get_feed()};
+    if (auto window{get_window(feed, recorder, selected)}; window) {
+      if (recorder.complete()) {
+        ifd::replay_feed replay{recorder.release(), window->margins(), feed};
+        return build(replay, *window, selected);
+      }
+
+      auto cropped{adapter_.get_feed(window->margins())};
+      return build(cropped, *window, selected);
+    }
+
+    return {};
+  }
+
+  template<typename Feed>
+  [[nodiscard]] std::vector<sid::nat::dimg_t>
+      build(Feed& feed, aws::window_info const& window, mode selected) {
+    auto dimensions{window.bounds().dimensions()};
+
+    std::vector<fgm::fragment> spliced{};
+    if (has_mode(selected, mode::pipelined)) {
+      auto snippets{prepare(feed, dimensions)};
+      spliced = splice(snippets);
+    }
+    else {
+      auto fragments{collect(feed, dimensions)};
+      spliced = splice(fragments);
+    }
+
+    auto filtered{filter(dimensions, spliced)};
+    return clean(filtered);
+  }
+
+  [[nodiscard]] inline auto get_window(mode selected) {
+    return get_window(
+        adapter_.get_feed(),
+        [](std::size_t /*unused*/, aws::image_type const& /*unused*/) noexcept {
+        },
+        selected);
+  }
+
+  template<typename Feed, typename Recorder>
+  [[nodiscard]] inline auto
+      get_window(Feed&& feed, Recorder&& record, mode selected) {
+    auto result{aws::scan(std::forward<Feed>(feed),
+                          adapter_.get_screen_dimensions(),
+                          cb(),
+                          std::forward<Recorder>(record),
+                          has_mode(selected, mode::pyramid)
+                              ? aws::detection::pyramid
+                              : aws::detection::full)};
 
     cb()(result);
     return result;
   }
 
-  [[nodiscard]] inline auto collect(feed_type& feed,
+  template<typename Feed>
+  [[nodiscard]] inline auto collect(Feed& feed,
                                     mrl::dimensions_t const& window) {
-    frc::collector collector{window};
+    frc::collector collector{window, adapter_.get_motion_prediction()};
 
     collector.collect(feed, adapter_.get_compression(), cb());
     auto result{collector.complete()};
@@ -60,6 +255,27 @@ private:
     return result;
   }
 
+  template<typename Feed>
+  [[nodiscard]] auto prepare(Feed& feed, mrl::dimensions_t const& window) {
+    details::preparer pending{
+        std::max(std::thread::hardware_concurrency(), 1u)};
+    auto dispatch{[&pending](fgm::fragment&& fragment) {
+      pending.dispatch(std::move(fragment));
+    }};
+
+    frc::collector collector{window, adapter_.get_motion_prediction()};
+    collector.collect(feed, adapter_.get_compression(), cb(), dispatch);
+
+    for (auto& fragment : collector.complete()) {
+      dispatch(std::move(fragment));
+    }
+
+    auto result{pending.finish()};
+
+    cb()("frc", result);
+    return result;
+  }
+
   [[nodiscard]] inline auto splice(std::list<fgm::fragment>& fragments) {
     auto result{fgs::splice(fragments.begin(), fragments.end())};
 
@@ -67,6 +283,13 @@ private:
     return result;
   }
 
+  [[nodiscard]] inline auto splice(fgs::snippets_t& snippets) {
+    auto result{fgs::splice(snippets)};
+
+    cb()("spl", result);
+    return result;
+  }
+
   [[nodiscard]] inline auto filter(mrl::dimensions_t const& window,
                                    std::vector<fgm::fragment>& fragments) {
     auto result{
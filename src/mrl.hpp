@@ -110,12 +110,18 @@ public:
     return output;
   }
 
-  [[nodiscard]] matrix crop(region_t region) const {
+  [[nodiscard]] inline matrix crop(region_t region) const {
+    return crop(region, data_.get_allocator());
+  }
+
+  template<typename Talloc>
+  [[nodiscard]] matrix<value_type, Talloc> crop(region_t region,
+                                                Talloc const& alloc) const {
     auto margins{region.margins()};
 
-    matrix output{
+    matrix<value_type, Talloc> output{
         {dimensions_.width_ - margins.x_, dimensions_.height_ - margins.y_},
-        data_.get_allocator()};
+        alloc};
 
     auto nwidth{output.width()};
 
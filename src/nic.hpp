@@ -3,6 +3,9 @@
 
 #include "icd.hpp"
 
+#include <algorithm>
+#include <span>
+
 namespace nic {
 
 template<typename Alloc>
@@ -104,63 +107,68 @@ template<typename Alloc>
   return result;
 }
 
-[[nodiscard]] sid::nat::dimg_t decompress(icd::compressed_t const& pack,
-                                          mrl::dimensions_t const& dim) {
-  sid::nat::dimg_t result{dim};
-
-  auto out{result.data()};
-
-  auto z{0};
-  for (auto it{pack.begin()}; it != pack.end(); ++it, ++z) {
-    auto value{*it};
-
-    switch (value & 0xc0) {
-    case 0x00:
-      for (auto count{(value >> 4) + 3}, i{0}; i < count; ++i) {
-        *(out++) = {static_cast<std::uint8_t>(value & 0x0f)};
-      }
-      break;
-
-    case 0x40: {
-      std::size_t size{0};
-      for (auto count{(value >> 4) & 3}, i{0}; i < count; ++i) {
-        size |= static_cast<std::size_t>(*++it) << (8 * i);
-      }
-
-      for (auto i{0}; i < size; ++i) {
-        *(out++) = {static_cast<std::uint8_t>(value & 0x0f)};
-      }
-    } break;
-
-    case 0x80: {
-      auto pixels{value & 0x3f};
-      auto bytes{(pixels >> 1) + (pixels & 1)};
+namespace details {
+  // fn(color, count) for each run of pixels, in image order
+  template<typename Fn>
+  void decode(icd::compressed_t const& pack, Fn&& fn) {
+    for (auto it{pack.begin()}; it != pack.end(); ++it) {
+      auto value{*it};
+
+      switch (value & 0xc0) {
+      case 0x00:
+        fn(static_cast<std::uint8_t>(value & 0x0f),
+           static_cast<std::size_t>((value >> 4) + 3));
+        break;
+
+      case 0x40: {
+        std::size_t size{0};
+        for (auto count{(value >> 4) & 3}, i{0}; i < count; ++i) {
+          size |= static_cast<std::size_t>(*++it) << (8 * i);
+        }
 
-      for (auto i{0}, j{0}; i < bytes; ++i, ++j) {
-        auto pair{*++it};
+        fn(static_cast<std::uint8_t>(value & 0x0f), size);
+      } break;
 
-        *(out++) = {static_cast<std::uint8_t>(pair >> 4)};
-        if (++j < pixels) {
-          *(out++) = {static_cast<std::uint8_t>(pair & 0x0f)};
+      case 0x80:
+      case 0xc0: {
+        auto pixels{value & 0x3f};
+        if ((value & 0x40) != 0) {
+          pixels = (pixels << 8) + *++it;
         }
-      }
-    } break;
 
-    case 0xc0: {
-      auto pixels{((value & 0x3f) << 8) + *++it};
-      auto bytes{(pixels >> 1) + (pixels & 1)};
+        for (auto i{0}; i < pixels; i += 2) {
+          auto pair{*++it};
 
-      for (auto i{0}, j{0}; i < bytes; ++i, ++j) {
-        auto pair{*++it};
-
-        *(out++) = {static_cast<std::uint8_t>(pair >> 4)};
-        if (++j < pixels) {
-          *(out++) = {static_cast<std::uint8_t>(pair & 0x0f)};
+          fn(static_cast<std::uint8_t>(pair >> 4), std::size_t{1});
+          if (i + 1 < pixels) {
+            fn(static_cast<std::uint8_t>(pair & 0x0f), std::size_t{1});
+          }
         }
+      } break;
       }
-    } break;
     }
   }
+} // namespace details
+
+// output has to hold all pixels of the image
+inline void decompress(icd::compressed_t const& pack,
+                       std::span<cpl::nat_cc> output) {
+  auto out{output.data()};
+  details::decode(pack, [&out](std::uint8_t color, std::size_t count) {
+    out = std::fill_n(out, count, cpl::nat_cc{color});
+  });
+}
+
+template<typename Alloc>
+inline void decompress(icd::compressed_t const& pack,
+                       sid::nat::aimg_t<Alloc>& output) {
+  decompress(pack, std::span{output.data(), output.end()});
+}
+
+[[nodiscard]] sid::nat::dimg_t decompress(icd::compressed_t const& pack,
+                                          mrl::dimensions_t const& dim) {
+  sid::nat::dimg_t result{dim};
+  decompress(pack, result);
 
   return result;
 }
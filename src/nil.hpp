@@ -10,18 +10,24 @@
 
 namespace nil {
 
+inline bool read_raw(std::filesystem::path const& filename,
+                     mrl::dimensions_t const& dimension,
+                     cpl::nat_cc* output) {
+  std::ifstream input{filename, std::ios::in | std::ios::binary};
+  if (!input.is_open()) {
+    return false;
+  }
+
+  return static_cast<bool>(
+      input.read(reinterpret_cast<char*>(output), dimension.area()));
+}
+
 template<typename Alloc>
 [[nodiscard]] auto read_raw(std::filesystem::path const& filename,
                             mrl::dimensions_t const& dimension,
                             Alloc const& alloc) {
   sid::nat::aimg_t<Alloc> result{dimension, alloc};
-
-  std::ifstream input{filename, std::ios::in | std::ios::binary};
-  if (!input.is_open()) {
-    return result;
-  }
-
-  input.read(reinterpret_cast<char*>(result.data()), dimension.area());
+  read_raw(filename, dimension, result.data());
 
   return result;
 }
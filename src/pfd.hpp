@@ -0,0 +1,188 @@
+// prefetching feed
+
+#pragma once
+
+#include "ifd.hpp"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+namespace pfd {
+
+// r(index, output) returns false if the frame cannot be read, which ends
+// the feed
+template<typename Ty>
+concept reader = requires(Ty r) {
+  { r.size() } -> std::convertible_to<std::size_t>;
+  {
+    r(std::size_t{}, std::declval<cpl::nat_cc*>())
+    } -> std::convertible_to<bool>;
+};
+
+namespace details {
+  template<typename Alloc>
+  void copy(cpl::nat_cc const* source,
+            mrl::dimensions_t const& dimensions,
+            mrl::region_t const& crop,
+            sid::nat::aimg_t<Alloc>& output) noexcept {
+    auto width{output.width()};
+
+    auto src{source + crop.top_ * dimensions.width_ + crop.left_};
+    for (auto dst{output.data()}, last{output.end()}; dst < last;
+         src += dimensions.width_, dst += width) {
+      std::copy(src, src + width, dst);
+    }
+  }
+} // namespace details
+
+class ring {
+public:
+  template<reader Reader>
+  ring(Reader reader, std::size_t area, std::size_t depth)
+      : area_{area}
+      , depth_{depth}
+      , buffer_(area * depth)
+      , worker_{[this, reader = std::move(reader)](std::stop_token token) {
+        fill(reader, token);
+      }} {
+  }
+
+  ring(ring const&) = delete;
+  ring& operator=(ring const&) = delete;
+
+  // waits for the next frame, false if the reader has failed before it
+  [[nodiscard]] bool ready() {
+    std::unique_lock lock{mutex_};
+    ready_.wait(lock, [this] { return filled_ != consumed_ || failed_; });
+
+    return filled_ != consumed_;
+  }
+
+  [[nodiscard]] cpl::nat_cc const* acquire() {
+    std::unique_lock lock{mutex_};
+    ready_.wait(lock, [this] { return filled_ != consumed_; });
+
+    return slot(consumed_);
+  }
+
+  void release() {
+    {
+      std::lock_guard lock{mutex_};
+      ++consumed_;
+    }
+
+    space_.notify_one();
+  }
+
+private:
+  template<typename Reader>
+  void fill(Reader& reader, std::stop_token token) {
+    for (std::size_t i{0}, count{reader.size()}; i < count; ++i) {
+      {
+        std::unique_lock lock{mutex_};
+        if (!space_.wait(lock, token, [this] {
+              return filled_ - consumed_ < depth_;
+            })) {
+          return;
+        }
+      }
+
+      auto read{static_cast<bool>(reader(i, slot(i)))};
+
+      {
+        std::lock_guard lock{mutex_};
+        if (read) {
+          ++filled_;
+        }
+        else {
+          failed_ = true;
+        }
+      }
+
+      ready_.notify_one();
+
+      if (!read) {
+        return;
+      }
+    }
+  }
+
+  [[nodiscard]] inline cpl::nat_cc* slot(std::size_t index) noexcept {
+    return buffer_.data() + index % depth_ * area_;
+  }
+
+private:
+  std::size_t area_;
+  std::size_t depth_;
+
+  std::vector<cpl::nat_cc> buffer_;
+
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::condition_variable_any space_;
+
+  std::size_t filled_{0};
+  std::size_t consumed_{0};
+  bool failed_{false};
+
+  std::jthread worker_;
+};
+
+template<reader Reader>
+class feed {
+public:
+  using reader_type = Reader;
+
+public:
+  inline feed(mrl::dimensions_t const& dimensions,
+              reader_type reader,
+              std::size_t depth,
+              std::optional<mrl::region_t> crop = {})
+      : dimensions_{dimensions}
+      , crop_{crop.value_or(mrl::region_t{})}
+      , count_{reader.size()}
+      , ring_{std::make_unique<ring>(
+            std::move(reader), dimensions.area(), depth)} {
+  }
+
+  // a frame that cannot be read ends the feed
+  [[nodiscard]] inline bool has_more() const noexcept {
+    return next_ < count_ && ring_->ready();
+  }
+
+  inline void crop(mrl::region_t const& region) noexcept {
+    crop_ = region;
+  }
+
+  template<typename Alloc>
+  [[nodiscard]] auto produce(Alloc const& alloc) {
+    using image_type = sid::nat::aimg_t<Alloc>;
+    using frame_type = ifd::frame<image_type>;
+
+    auto margins{crop_.margins()};
+    image_type image{{dimensions_.width_ - margins.x_,
+                      dimensions_.height_ - margins.y_},
+                     alloc};
+
+    details::copy(ring_->acquire(), dimensions_, crop_, image);
+    ring_->release();
+
+    return frame_type{next_++, std::move(image)};
+  }
+
+private:
+  mrl::dimensions_t dimensions_;
+  mrl::region_t crop_;
+
+  std::size_t count_;
+  std::size_t next_{0};
+
+  std::unique_ptr<ring> ring_;
+};
+
+} // namespace pfd
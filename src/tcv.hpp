@@ -0,0 +1,161 @@
+// tiled canvas
+
+#pragma once
+
+#include "mrl.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace tcv {
+
+using point_t = cdt::point<std::int32_t>;
+
+template<typename Ty, std::size_t Size = 64>
+class canvas {
+public:
+  using value_type = Ty;
+
+  static inline constexpr std::int32_t tile_size{Size};
+
+  using tile_type = std::array<value_type, Size * Size>;
+
+public:
+  inline canvas() noexcept = default;
+
+  inline canvas(canvas&&) noexcept = default;
+  inline canvas& operator=(canvas&&) noexcept = default;
+
+  canvas(canvas const& other)
+      : origin_{other.origin_}
+      , width_{other.width_}
+      , height_{other.height_} {
+    tiles_.reserve(other.tiles_.size());
+    for (auto& tile : other.tiles_) {
+      tiles_.push_back(tile ? std::make_unique<tile_type>(*tile) : nullptr);
+    }
+  }
+
+  canvas& operator=(canvas const& rhs) {
+    canvas tmp{rhs};
+    *this = std::move(tmp);
+    return *this;
+  }
+
+  // fn(position, data, count) for each row segment that lies in one tile,
+  // in row-major order; tiles are allocated as they are touched
+  template<typename Fn>
+  void write(point_t pos, mrl::dimensions_t const& dim, Fn&& fn) {
+    if (dim.area() == 0) {
+      return;
+    }
+
+    cover(pos, dim);
+    visit(pos, dim, [this, &fn](point_t at, std::size_t index, auto count) {
+      auto& tile{tiles_[index]};
+      if (!tile) {
+        tile = std::make_unique<tile_type>();
+      }
+
+      fn(at, tile->data() + offset(at), count);
+    });
+  }
+
+  // same as write, but data is null for segments of unallocated tiles
+  template<typename Fn>
+  void read(point_t pos, mrl::dimensions_t const& dim, Fn&& fn) const {
+    visit(pos, dim, [this, &fn](point_t at, std::size_t index, auto count) {
+      value_type const* data{nullptr};
+      if (index < tiles_.size() && tiles_[index]) {
+        data = tiles_[index]->data() + offset(at);
+      }
+
+      fn(at, data, count);
+    });
+  }
+
+  [[nodiscard]] inline std::size_t allocated() const noexcept {
+    return std::count_if(tiles_.begin(), tiles_.end(), [](auto& tile) {
+      return tile != nullptr;
+    });
+  }
+
+private:
+  [[nodiscard]] static inline std::int32_t tile_of(std::int32_t v) noexcept {
+    return (v >= 0 ? v : v - (tile_size - 1)) / tile_size;
+  }
+
+  [[nodiscard]] static inline std::size_t offset(point_t at) noexcept {
+    auto x{at.x_ - tile_of(at.x_) * tile_size};
+    auto y{at.y_ - tile_of(at.y_) * tile_size};
+
+    return static_cast<std::size_t>(y * tile_size + x);
+  }
+
+  template<typename Fn>
+  void visit(point_t pos, mrl::dimensions_t const& dim, Fn&& fn) const {
+    auto right{pos.x_ + static_cast<std::int32_t>(dim.width_)};
+    auto bottom{pos.y_ + static_cast<std::int32_t>(dim.height_)};
+
+    for (auto y{pos.y_}; y < bottom; ++y) {
+      auto ty{tile_of(y) - origin_.y_};
+      for (auto x{pos.x_}; x < right;) {
+        auto tx{tile_of(x) - origin_.x_};
+        auto count{std::min((tile_of(x) + 1) * tile_size, right) - x};
+
+        auto index{tx < 0 || ty < 0 || tx >= width_ || ty >= height_
+                       ? tiles_.size()
+                       : static_cast<std::size_t>(ty * width_ + tx)};
+
+        fn(point_t{x, y}, index, static_cast<std::size_t>(count));
+        x += count;
+      }
+    }
+  }
+
+  void cover(point_t pos, mrl::dimensions_t const& dim) {
+    point_t low{tile_of(pos.x_), tile_of(pos.y_)};
+    point_t high{
+        tile_of(pos.x_ + static_cast<std::int32_t>(dim.width_) - 1) + 1,
+        tile_of(pos.y_ + static_cast<std::int32_t>(dim.height_) - 1) + 1};
+
+    if (!tiles_.empty()) {
+      low = {std::min(low.x_, origin_.x_), std::min(low.y_, origin_.y_)};
+      high = {std::max(high.x_, origin_.x_ + width_),
+              std::max(high.y_, origin_.y_ + height_)};
+    }
+
+    auto width{high.x_ - low.x_}, height{high.y_ - low.y_};
+    if (low == origin_ && width == width_ && height == height_) {
+      return;
+    }
+
+    std::vector<std::unique_ptr<tile_type>> tiles(
+        static_cast<std::size_t>(width * height));
+
+    for (std::int32_t y{0}; y < height_; ++y) {
+      auto src{tiles_.begin() + y * width_};
+      auto dst{tiles.begin() + (y + origin_.y_ - low.y_) * width +
+               (origin_.x_ - low.x_)};
+
+      std::move(src, src + width_, dst);
+    }
+
+    tiles_ = std::move(tiles);
+    origin_ = low;
+    width_ = width;
+    height_ = height;
+  }
+
+private:
+  std::vector<std::unique_ptr<tile_type>> tiles_;
+
+  point_t origin_{};
+  std::int32_t width_{0};
+  std::int32_t height_{0};
+};
+
+} // namespace tcv